@@ -21,11 +21,23 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <errno.h>
 #include "block.h"
 
 #define MAX_TRIES		1
 
-size_t block_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t starting_block)
+/* Requests made through block_read() and block_submit(), for reporting how
+ *  many a file load needed.  Those the layers of block devices (partitions,
+ *  the cache etc) make of each other while handling one are not counted. */
+static uint32_t io_count = 0;
+static int io_depth = 0;
+
+uint32_t block_get_io_count(void)
+{
+	return io_count;
+}
+
+static size_t do_block_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t starting_block)
 {
 	// Read the required number of blocks to satisfy the request
 	int buf_offset = 0;
@@ -83,6 +95,32 @@ size_t block_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint3
 	return (size_t)buf_offset;
 }
 
+size_t block_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t starting_block)
+{
+	if(io_depth++ == 0)
+		io_count++;
+	size_t ret = do_block_read(dev, buf, buf_size, starting_block);
+	io_depth--;
+	return ret;
+}
+
+static int block_write_tries(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t block_num)
+{
+	int tries = 0;
+	while(1)
+	{
+		int ret = dev->write(dev, buf, buf_size, block_num);
+		if(ret < 0)
+		{
+			tries++;
+			if(tries >= MAX_TRIES)
+				return ret;
+		}
+		else
+			return ret;
+	}
+}
+
 size_t block_write(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t starting_block)
 {
 	// Write the required number of blocks to satisfy the request
@@ -92,6 +130,43 @@ size_t block_write(struct block_device *dev, uint8_t *buf, size_t buf_size, uint
 	if(!dev->write)
 		return 0;
 
+	// Write all the whole blocks with multi-block writes if the device
+	//  supports it, splitting them at allocation unit boundaries so that
+	//  no single write straddles two units
+	if(dev->supports_multiple_block_write && ((buf_size / dev->block_size) > 1))
+	{
+		while(buf_size >= dev->block_size)
+		{
+			size_t blocks = buf_size / dev->block_size;
+			if(dev->au_blocks)
+			{
+				size_t au_left = dev->au_blocks -
+					((starting_block + block_offset) % dev->au_blocks);
+				if(blocks > au_left)
+					blocks = au_left;
+			}
+			size_t to_write = blocks * dev->block_size;
+
+#ifdef BLOCK_DEBUG
+			printf("block_write: performing multi block write (%i blocks) to "
+				"block %i on %s\n", blocks, starting_block + block_offset,
+				dev->device_name);
+#endif
+
+			int ret = block_write_tries(dev, &buf[buf_offset], to_write,
+					starting_block + block_offset);
+			if(ret < 0)
+				return ret;
+
+			buf_offset += (int)to_write;
+			block_offset += blocks;
+			buf_size -= to_write;
+		}
+
+		if(buf_size == 0)
+			return (size_t)buf_offset;
+	}
+
 	do
 	{
 		size_t to_write = buf_size;
@@ -103,20 +178,10 @@ size_t block_write(struct block_device *dev, uint8_t *buf, size_t buf_size, uint
 				starting_block + block_offset, dev->device_name);
 #endif
 
-		int tries = 0;
-		while(1)
-		{
-			int ret = dev->write(dev, &buf[buf_offset], to_write,
-					starting_block + block_offset);
-			if(ret < 0)
-			{
-				tries++;
-				if(tries >= MAX_TRIES)
-					return ret;
-			}
-			else
-				break;
-		}
+		int ret = block_write_tries(dev, &buf[buf_offset], to_write,
+				starting_block + block_offset);
+		if(ret < 0)
+			return ret;
 
 		buf_offset += (int)to_write;
 		block_offset++;
@@ -129,3 +194,72 @@ size_t block_write(struct block_device *dev, uint8_t *buf, size_t buf_size, uint
 
 	return (size_t)buf_offset;
 }
+
+/* Asynchronous requests
+ *
+ * Devices without native support have their requests performed
+ * synchronously by block_submit(), so callers can always use the same
+ * submit/poll/wait sequence.
+ */
+
+void block_complete(struct block_request *req, int result)
+{
+	req->result = result;
+	req->done = 1;
+	if(req->callback)
+		req->callback(req);
+}
+
+static int do_block_submit(struct block_device *dev, struct block_request *req)
+{
+	req->done = 0;
+	req->result = 0;
+	req->next = NULL;
+
+	if(dev->submit)
+	{
+		// Wait for space in the queue
+		while(1)
+		{
+			errno = 0;
+			int ret = dev->submit(dev, req);
+			if((ret == 0) || (errno != EBUSY))
+				return ret;
+			block_poll(dev);
+		}
+	}
+
+	size_t ret;
+	if(req->is_write)
+		ret = block_write(dev, req->buf, req->buf_size, req->block_num);
+	else
+		ret = block_read(dev, req->buf, req->buf_size, req->block_num);
+	block_complete(req, (int)ret);
+	return 0;
+}
+
+int block_submit(struct block_device *dev, struct block_request *req)
+{
+	if(io_depth++ == 0)
+		io_count++;
+	int ret = do_block_submit(dev, req);
+	io_depth--;
+	return ret;
+}
+
+int block_poll(struct block_device *dev)
+{
+	int ret = 0;
+	io_depth++;
+	if(dev->poll)
+		ret = dev->poll(dev);
+	io_depth--;
+	return ret;
+}
+
+int block_wait(struct block_device *dev, struct block_request *req)
+{
+	while(!req->done)
+		block_poll(dev);
+	return req->result;
+}
@@ -26,6 +26,32 @@
 #include <stddef.h>
 
 struct fs;
+struct block_device;
+
+/* An asynchronous block request, see block_submit()
+ *
+ * The request (and its buffer) must remain valid until it has completed.
+ * Drivers which pass requests on to a parent device (e.g. partitions) may
+ * adjust block_num on the way.
+ */
+struct block_request {
+	int is_write;
+	uint8_t *buf;
+	size_t buf_size;
+	uint32_t block_num;
+
+	// Called once the request has completed (may be NULL)
+	void (*callback)(struct block_request *req);
+	void *opaque;
+
+	// Set on completion: result is the number of bytes transferred or < 0
+	//  on error
+	volatile int done;
+	int result;
+
+	// For use by the driver which currently owns the request
+	struct block_request *next;
+};
 
 struct block_device {
 	char *driver_name;
@@ -38,15 +64,34 @@ struct block_device {
 
 	int (*read)(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t block_num);
 	int (*write)(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t block_num);
+
+	// Optional native support for asynchronous requests.  submit() queues a
+	//  request (returning -1 with errno = EBUSY if queue_depth requests are
+	//  already outstanding) and poll() makes progress on the queue,
+	//  returning the number of requests still outstanding.
+	int (*submit)(struct block_device *dev, struct block_request *req);
+	int (*poll)(struct block_device *dev);
+	int queue_depth;
+
 	size_t block_size;
 	size_t num_blocks;
 
+	// Large writes are split at multiples of this many blocks (e.g. the
+	//  allocation unit of an SD card), 0 if the device has no preference
+	size_t au_blocks;
+
 	struct fs *fs;
 };
 
 size_t block_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t starting_block);
 size_t block_write(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t starting_block);
 
+int block_submit(struct block_device *dev, struct block_request *req);
+int block_poll(struct block_device *dev);
+int block_wait(struct block_device *dev, struct block_request *req);
+void block_complete(struct block_request *req, int result);
+uint32_t block_get_io_count(void);
+
 #endif
 
 #include "fs.h"
@@ -52,6 +52,8 @@ struct cache_dev
 
 int cache_read(struct block_device *, uint8_t *buf, size_t buf_size, uint32_t starting_block);
 int cache_write(struct block_device *, uint8_t *buf, size_t buf_size, uint32_t starting_block);
+static int cache_submit(struct block_device *, struct block_request *req);
+static int cache_poll(struct block_device *);
 inline static int cache_idx(struct cache_dev *dev, uint32_t block_no);
 
 int cache_init(struct block_device *parent, struct block_device **dev, uintptr_t cache_start, size_t cache_length)
@@ -84,6 +86,13 @@ int cache_init(struct block_device *parent, struct block_device **dev, uintptr_t
 		cd->bd.write = cache_write;
 	cd->bd.supports_multiple_block_read = parent->supports_multiple_block_read;
 	cd->bd.supports_multiple_block_write = parent->supports_multiple_block_write;
+	cd->bd.au_blocks = parent->au_blocks;
+	if(parent->submit)
+	{
+		cd->bd.submit = cache_submit;
+		cd->bd.poll = cache_poll;
+		cd->bd.queue_depth = parent->queue_depth;
+	}
 	
 	// Calculate the number of cache entries
 	int cache_entries = cache_length / cd->bd.block_size;
@@ -226,3 +235,26 @@ int cache_write(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_
 
 	return buf_size;
 }
+
+// Multiblock reads bypass the cache (as in cache_read) so can be queued on
+//  the parent.  Everything else goes through the cache synchronously.
+static int cache_submit(struct block_device *dev, struct block_request *req)
+{
+	struct cache_dev *cd = (struct cache_dev *)dev;
+
+	if(!req->is_write && (req->buf_size > cd->bd.block_size))
+		return block_submit(cd->parent, req);
+
+	int ret;
+	if(req->is_write)
+		ret = cache_write(dev, req->buf, req->buf_size, req->block_num);
+	else
+		ret = cache_read(dev, req->buf, req->buf_size, req->block_num);
+	block_complete(req, ret);
+	return 0;
+}
+
+static int cache_poll(struct block_device *dev)
+{
+	return block_poll(((struct cache_dev *)dev)->parent);
+}
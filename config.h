@@ -76,6 +76,42 @@
 /* Enable write-back cache support (currently not implemented) */
 #undef ENABLE_BLOCK_CACHE_WB
 
+/* Allow kernels and modules to be gzip, zlib or LZ4 compressed */
+#define ENABLE_DECOMPRESS
+
+/* Read kernels and modules ahead asynchronously so that I/O overlaps with
+ * decompression, and report how long each stage of loading took */
+#define ENABLE_LOAD_PIPELINE
+
+/* Keep a small amount of state (e.g. SD card parameters) in a reserved area
+ * of memory which survives warm reboots, so that subsequent boots are faster */
+#define ENABLE_PERSIST
+
+/* Size of the area used by ENABLE_PERSIST.  It is taken from the top of ARM
+ * memory and removed from the memory available to loaded kernels and modules.
+ * Define PERSIST_BASE to put it at a fixed address instead (which must not be
+ * where any kernel is linked to load, e.g. 0x100000). */
+#define PERSIST_LENGTH			0x10000
+
+/* Record the kernel and modules loaded in the persistent area, and after a
+ * warm reboot use the copies still in memory instead of reloading them if
+ * neither the files nor the copies have changed (requires ENABLE_PERSIST) */
+#undef ENABLE_FAST_REBOOT
+
+/* Keep contiguous copies of the kernel and modules on a raw partition named
+ * by the image_cache command, so they can be loaded without going through
+ * the filesystem.  New copies are only used once the kernel confirms it
+ * booted (requires ENABLE_PERSIST) */
+#undef ENABLE_IMAGE_CACHE
+
+/* Record the time each boot phase and file load took, print it before the
+ * kernel is started and pass it to the kernel (see MULTIBOOT-ARM) */
+#define ENABLE_BOOT_TIMELINE
+
+/* Boot Linux zImage (or arm64 Image) kernels directly, with an initrd and
+ * device tree given by the initrd and dtb commands */
+#define ENABLE_LINUX_BOOT
+
 /* Presence of <unwind.h> header file.  Modern GCC should have this. */
 #define HAVE_UNWIND_H
 
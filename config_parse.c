@@ -26,6 +26,10 @@
 #include "stdio.h"
 #include "stdlib.h"
 #include "string.h"
+#include "output.h"
+#ifdef ENABLE_BOOT_TIMELINE
+#include "timeline.h"
+#endif
 
 static char *read_line(char **buf)
 {
@@ -156,6 +160,12 @@ int config_parse(char *buf, char delim,
 			if(!strcmp(lwr, curmethod->name))
 			{
 				found = 1;
+#ifdef ENABLE_BOOT_TIMELINE
+				timeline_mark(curmethod->name);
+#endif
+				// Show progress so far before what may be a long
+				//  running command
+				output_flush();
 				int retno = curmethod->method(args);
 				if(retno != 0)
 				{
@@ -22,9 +22,11 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "fb.h"
 #include "console.h"
 #include "util.h"
+#include "timer.h"
 
 #ifdef ENABLE_DEFAULT_FONT
 extern uint8_t vgafont8[];
@@ -60,12 +62,80 @@ extern uint8_t		FONT[];
 #define DEF_FORE	0xffffffff
 #define DEF_BACK	0x00000000
 
+// Both the default font and the example alternative fonts have 128 glyphs
+#define FONT_GLYPHS	128
+
 static int cur_x = 0;
 static int cur_y = 0;
 
+// The line of the virtual framebuffer at the top of the display
+static int scroll_y = 0;
+
+/* The font pre-expanded to the framebuffer's pixel format in the console
+ *  colours, so draw_char only has to copy each glyph row into place */
+static uint8_t *glyphs = NULL;
+static int glyph_row_bytes;
+static uint32_t glyph_fore, glyph_back;
+
 static uint32_t cur_fore = DEF_FORE;
 static uint32_t cur_back = DEF_BACK;
 
+/* Text-cell shadow of the screen.  Once console_init has allocated it,
+ *  console_putc only updates the cells and the framebuffer is brought up
+ *  to date by console_flush.  That runs at a newline if CONSOLE_FLUSH_US
+ *  has passed since the last one, and wherever output must be visible:
+ *  before each config command and on fflush(stdout).  Lines which scroll
+ *  off in between are never drawn.  At handover the console goes back to
+ *  drawing each character (see console_set_immediate). */
+#define CONSOLE_FLUSH_US	20000
+
+struct console_cell
+{
+	uint8_t c;
+	uint8_t attr;		// 0 is the default colours
+};
+
+static struct console_cell *cells = NULL;
+static int rows, cols;
+static int top_row;			// row of cells shown at the top of the screen
+static int16_t *dirty_lo, *dirty_hi;	// columns to redraw per row of cells
+static int pending_scroll;		// rows scrolled in cells but not on screen
+static struct timer_wait flush_timer;
+
+static inline int cell_row(int y)
+{
+	int row = top_row + y;
+	if(row >= rows)
+		row -= rows;
+	return row;
+}
+
+static void mark_dirty(int row, int lo, int hi)
+{
+	if(lo < dirty_lo[row])
+		dirty_lo[row] = (int16_t)lo;
+	if(hi > dirty_hi[row])
+		dirty_hi[row] = (int16_t)hi;
+}
+
+static void mark_all_dirty()
+{
+	for(int row = 0; row < rows; row++)
+	{
+		dirty_lo[row] = 0;
+		dirty_hi[row] = (int16_t)(cols - 1);
+	}
+}
+
+static void clear_cells(int row)
+{
+	for(int x = 0; x < cols; x++)
+	{
+		cells[row * cols + x].c = ' ';
+		cells[row * cols + x].attr = 0;
+	}
+}
+
 void clear()
 {
 	int height = fb_get_height();
@@ -76,17 +146,236 @@ void clear()
 	for(int line = 0; line < height; line++)
 		memset(&fb[line * pitch], 0, line_byte_width);
 
+	if(scroll_y)
+	{
+		scroll_y = 0;
+		fb_set_virt_offset(0);
+	}
+
+	// The screen now matches blank cells
+	if(cells)
+	{
+		for(int row = 0; row < rows; row++)
+		{
+			clear_cells(row);
+			dirty_lo[row] = (int16_t)cols;
+			dirty_hi[row] = -1;
+		}
+		top_row = 0;
+		pending_scroll = 0;
+	}
+
 	cur_x = 0;
 	cur_y = 0;
 }
 
+/* Move what is on the display to the start of the framebuffer, for kernels
+ *  which expect to find it there */
+void console_reset_scroll()
+{
+	if(cells)
+	{
+		console_flush();
+		if(scroll_y)
+		{
+			// Redrawing from the cells is cheaper than copying the screen
+			scroll_y = 0;
+			mark_all_dirty();
+			console_flush();
+			fb_set_virt_offset(0);
+		}
+		return;
+	}
+
+	if(scroll_y == 0)
+		return;
+
+	uint8_t *fb = (uint8_t *)fb_get_framebuffer();
+	int line_byte_width = fb_get_width() * (fb_get_bpp() >> 3);
+	int pitch = fb_get_pitch();
+	int height = fb_get_height();
+
+	for(int line = 0; line < height; line++)
+		memcpy(&fb[line * pitch], &fb[(line + scroll_y) * pitch], line_byte_width);
+
+	scroll_y = 0;
+	fb_set_virt_offset(0);
+}
+
 #ifdef FONT
+static void expand_glyphs(uint32_t fore, uint32_t back)
+{
+	int bytes_per_pixel = fb_get_bpp() >> 3;
+	glyph_row_bytes = CHAR_W * bytes_per_pixel;
+
+	if(glyphs == NULL)
+		glyphs = (uint8_t *)malloc(FONT_GLYPHS * CHAR_H * glyph_row_bytes);
+	if(glyphs == NULL)
+		return;
+
+	for(int c = 0; c < FONT_GLYPHS; c++)
+	{
+		uint8_t *d = &glyphs[c * CHAR_H * glyph_row_bytes];
+		int s_offset = c * CHAR_W * CHAR_H;
+
+		for(int p = 0; p < CHAR_W * CHAR_H; p++, s_offset++)
+		{
+			int s_bit_no = s_offset % 8;
+			uint32_t colour = back;
+			if((FONT[s_offset / 8] >> BIT_SHIFT) & 0x1)
+				colour = fore;
+
+			switch(bytes_per_pixel)
+			{
+				case 2:
+					((uint16_t *)d)[p] = (uint16_t)colour;
+					break;
+				case 4:
+					((uint32_t *)d)[p] = colour;
+					break;
+				default:
+					for(int i = 0; i < bytes_per_pixel; i++)
+					{
+						d[p * bytes_per_pixel + i] = (uint8_t)(colour & 0xff);
+						colour >>= 8;
+					}
+					break;
+			}
+		}
+	}
+
+	glyph_fore = fore;
+	glyph_back = back;
+}
+
+// Called once the framebuffer is set up
+void console_init()
+{
+	expand_glyphs(cur_fore, cur_back);
+
+	rows = fb_get_height() / CHAR_H;
+	cols = fb_get_width() / CHAR_W;
+	cells = (struct console_cell *)malloc(rows * cols * sizeof(struct console_cell));
+	dirty_lo = (int16_t *)malloc(rows * sizeof(int16_t));
+	dirty_hi = (int16_t *)malloc(rows * sizeof(int16_t));
+	if(!cells || !dirty_lo || !dirty_hi)
+	{
+		// Fall back to drawing each character as it is output
+		free(cells);
+		free(dirty_lo);
+		free(dirty_hi);
+		cells = NULL;
+		return;
+	}
+
+	for(int row = 0; row < rows; row++)
+		clear_cells(row);
+	top_row = 0;
+	pending_scroll = 0;
+	mark_all_dirty();
+}
+
+/* Draw everything outstanding and from then on draw each character as it
+ *  is output.  Used at handover, as nothing calls console_flush once the
+ *  kernel is running. */
+void console_set_immediate()
+{
+	if(!cells)
+		return;
+
+	console_flush();
+	free(cells);
+	free(dirty_lo);
+	free(dirty_hi);
+	cells = NULL;
+}
+
+// Start a new line in the cells, scrolling them if necessary
+static void cell_newline()
+{
+	cur_x = 0;
+	cur_y++;
+	if(cur_y == rows)
+	{
+		int row = top_row;
+		top_row = cell_row(1);
+		clear_cells(row);
+		mark_dirty(row, 0, cols - 1);
+		pending_scroll++;
+		cur_y--;
+	}
+}
+
+// Bring the framebuffer up to date with the cells
+void console_flush()
+{
+	if(!cells)
+		return;
+
+	int moved = 0;
+	if(pending_scroll)
+	{
+		/* Scroll using the virtual offset if there is room, otherwise (or
+		 *  if everything on screen has changed anyway) start again at the
+		 *  top and redraw every row */
+		int height = fb_get_height();
+		int new_y = scroll_y + pending_scroll * CHAR_H;
+		if((pending_scroll >= rows) || (new_y + height > fb_get_virt_height()))
+		{
+			new_y = 0;
+			mark_all_dirty();
+		}
+
+		if(new_y != scroll_y)
+		{
+			scroll_y = new_y;
+			moved = 1;
+
+			// Clear the part of the screen below the last row of text
+			uint8_t *fb = (uint8_t *)fb_get_framebuffer();
+			int line_byte_width = fb_get_width() * (fb_get_bpp() >> 3);
+			int pitch = fb_get_pitch();
+			for(int line = scroll_y + rows * CHAR_H; line < scroll_y + height; line++)
+				memset(&fb[line * pitch], 0, line_byte_width);
+		}
+		pending_scroll = 0;
+	}
+
+	for(int y = 0; y < rows; y++)
+	{
+		int row = cell_row(y);
+		for(int x = dirty_lo[row]; x <= dirty_hi[row]; x++)
+		{
+			struct console_cell *cell = &cells[row * cols + x];
+			draw_char((char)cell->c, x, y, cur_fore, cur_back);
+		}
+		dirty_lo[row] = (int16_t)cols;
+		dirty_hi[row] = -1;
+	}
+
+	// Only show the new position once it has been drawn
+	if(moved)
+		fb_set_virt_offset(scroll_y);
+
+	flush_timer = register_timer(CONSOLE_FLUSH_US);
+}
+
+int console_write(const char *buf, size_t len)
+{
+	for(size_t i = 0; i < len; i++)
+		console_putc(buf[i]);
+	return (int)len;
+}
+
 void newline()
 {
 	cur_y++;
 	cur_x = 0;
 
-	// Scroll up if necessary
+	/* Scroll up if necessary.  While there is room below the display in
+	 *  the virtual framebuffer this only moves the virtual offset down a
+	 *  row; once the end is reached the display is copied back to the top.
+	 *  With a two screen framebuffer that is one copy per screenful. */
 	if(cur_y == fb_get_height() / CHAR_H)
 	{
 		uint8_t *fb = (uint8_t *)fb_get_framebuffer();
@@ -94,17 +383,49 @@ void newline()
 		int pitch = fb_get_pitch();
 		int height = fb_get_height();
 
-		for(int line = 0; line < (height - CHAR_H); line++)
-			quick_memcpy(&fb[line * pitch], &fb[(line + CHAR_H) * pitch], line_byte_width);
-		for(int line = height - CHAR_H; line < height; line++)
+		if(scroll_y + CHAR_H + height <= fb_get_virt_height())
+			scroll_y += CHAR_H;
+		else
+		{
+			for(int line = 0; line < (height - CHAR_H); line++)
+				memcpy(&fb[line * pitch], &fb[(line + scroll_y + CHAR_H) * pitch],
+						line_byte_width);
+			scroll_y = 0;
+		}
+
+		// Clear the new last row, and anything below it
+		int last_row = scroll_y + (cur_y - 1) * CHAR_H;
+		for(int line = last_row; line < scroll_y + height; line++)
 			memset(&fb[line * pitch], 0, line_byte_width);
 
+		fb_set_virt_offset(scroll_y);
+
 		cur_y--;
 	}
 }
 
 int console_putc(int c)
 {
+	if(cells)
+	{
+		if(c == '\n')
+		{
+			cell_newline();
+			if(compare_timer(flush_timer))
+				console_flush();
+		}
+		else
+		{
+			int row = cell_row(cur_y);
+			cells[row * cols + cur_x].c = (uint8_t)c;
+			cells[row * cols + cur_x].attr = 0;
+			mark_dirty(row, cur_x, cur_x);
+			if(++cur_x == cols)
+				cell_newline();
+		}
+		return c;
+	}
+
 	int line_w = fb_get_width() / CHAR_W;
 
 	if(c == '\n')
@@ -120,15 +441,64 @@ int console_putc(int c)
 	return c;
 }
 
+// Copy a pre-expanded glyph, a row at a time
+static void blit_glyph(int glyph, int x, int y)
+{
+	int pitch = fb_get_pitch();
+	uint8_t *d = (uint8_t *)fb_get_framebuffer() + (y * CHAR_H + scroll_y) * pitch +
+			x * glyph_row_bytes;
+	const uint8_t *s = &glyphs[glyph * CHAR_H * glyph_row_bytes];
+
+	if((((uintptr_t)d | (uintptr_t)pitch | (uintptr_t)glyph_row_bytes) & 3) != 0)
+	{
+		for(int c_y = 0; c_y < CHAR_H; c_y++, d += pitch, s += glyph_row_bytes)
+			memcpy(d, s, glyph_row_bytes);
+		return;
+	}
+
+	for(int c_y = 0; c_y < CHAR_H; c_y++, d += pitch, s += glyph_row_bytes)
+	{
+		uint32_t *dw = (uint32_t *)d;
+		const uint32_t *sw = (const uint32_t *)s;
+
+		switch(glyph_row_bytes)
+		{
+			case 16:
+				// 8 pixels at 16 bpp
+				dw[0] = sw[0]; dw[1] = sw[1]; dw[2] = sw[2]; dw[3] = sw[3];
+				break;
+			case 32:
+				// 8 pixels at 32 bpp
+				dw[0] = sw[0]; dw[1] = sw[1]; dw[2] = sw[2]; dw[3] = sw[3];
+				dw[4] = sw[4]; dw[5] = sw[5]; dw[6] = sw[6]; dw[7] = sw[7];
+				break;
+			default:
+				for(int i = 0; i < glyph_row_bytes / 4; i++)
+					dw[i] = sw[i];
+				break;
+		}
+	}
+}
+
 void draw_char(char c, int x, int y, uint32_t fore, uint32_t back)
 {
+	int glyph = (uint8_t)c;
+	if(glyph >= FONT_GLYPHS)
+		glyph = '?';
+
+	if(glyphs && (fore == glyph_fore) && (back == glyph_back))
+	{
+		blit_glyph(glyph, x, y);
+		return;
+	}
+
 	volatile uint8_t *fb = (uint8_t *)fb_get_framebuffer();
 	int bpp = fb_get_bpp();
 	int bytes_per_pixel = bpp >> 3;
 
-	int d_offset = y * CHAR_H * fb_get_pitch() + x * bytes_per_pixel * CHAR_W;
+	int d_offset = (y * CHAR_H + scroll_y) * fb_get_pitch() + x * bytes_per_pixel * CHAR_W;
 	int line_d_offset = d_offset;
-	int s_offset = (int)c * CHAR_W * CHAR_H;
+	int s_offset = glyph * CHAR_W * CHAR_H;
 
 	for(int c_y = 0; c_y < CHAR_H; c_y++)
 	{
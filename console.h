@@ -22,9 +22,16 @@
 #ifndef CONSOLE_H
 #define CONSOLE_H
 
+#include <stddef.h>
+
+void console_init();
 void clear();
+void console_reset_scroll();
+void console_flush();
+void console_set_immediate();
 void draw_char(char c, int x, int y, uint32_t fore, uint32_t back);
 int console_putc(int c);
+int console_write(const char *buf, size_t len);
 
 #endif
 
@@ -45,6 +45,7 @@
 // Taken from the FreeBSD kernel sources and modified for rpi_boot
 #include <stdint.h>
 #include <stdlib.h>
+#include "crc32.h"
 
 const uint32_t crc32_tab[] = {
 	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
@@ -92,21 +93,80 @@ const uint32_t crc32_tab[] = {
 	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
-/*
- * A function that calculates the CRC-32 based on the table above is
- * given below for documentation purposes. An equivalent implementation
- * of this function that's actually used in the kernel can be found
- * in sys/libkern.h, where it can be inlined.
- */
+/* Slicing-by-8: crc32_slice[k][i] is the CRC contribution of byte i
+ *  followed by k + 1 zero bytes, so eight bytes can be folded in with
+ *  eight independent table lookups.  The tables are built from crc32_tab
+ *  on first use. */
+typedef uint32_t __attribute__((__may_alias__)) crc32_word_t;
+
+static uint32_t crc32_slice[7][256];
+static int crc32_slice_ready;
+
+// Below this slicing (and the table build) is not worth it
+#define CRC32_SLICE_MIN		16
+
+static void crc32_init_slices(void)
+{
+	for(int i = 0; i < 256; i++)
+	{
+		uint32_t c = crc32_tab[i];
+		for(int k = 0; k < 7; k++)
+		{
+			c = crc32_tab[c & 0xFF] ^ (c >> 8);
+			crc32_slice[k][i] = c;
+		}
+	}
+	crc32_slice_ready = 1;
+}
+
+#ifdef __aarch64__
+/* ARMv8 CRC32 instructions.  These are optional in v8.0, so unless the
+ *  compiler has been told they exist check ID_AA64ISAR0_EL1 */
+static int crc32_hw;
+
+static int crc32_have_hw(void)
+{
+#if defined(__ARM_FEATURE_CRC32)
+	return 1;
+#elif defined(BUILDING_RPIBOOT)
+	if(crc32_hw == 0)
+	{
+		uint64_t isar0;
+		__asm__ volatile("mrs %0, id_aa64isar0_el1" : "=r" (isar0));
+		crc32_hw = ((isar0 >> 16) & 0xf) ? 1 : -1;
+	}
+	return crc32_hw > 0;
+#else
+	return 0;
+#endif
+}
+
+static uint32_t crc32_append_hw(uint32_t crc, const uint8_t *p, size_t size)
+{
+	while(size && ((uintptr_t)p & 7))
+	{
+		__asm__(".arch_extension crc\n\tcrc32b %w0, %w0, %w1"
+				: "+r" (crc) : "r" ((uint32_t)*p++));
+		size--;
+	}
+	while(size >= 8)
+	{
+		__asm__(".arch_extension crc\n\tcrc32x %w0, %w0, %x1"
+				: "+r" (crc) : "r" (*(const uint64_t *)p));
+		p += 8;
+		size -= 8;
+	}
+	while(size--)
+		__asm__(".arch_extension crc\n\tcrc32b %w0, %w0, %w1"
+				: "+r" (crc) : "r" ((uint32_t)*p++));
+	return crc;
+}
+#endif
+
 uint32_t
 crc32(const void *buf, size_t size)
 {
-	const uint8_t *p = buf;
-	uint32_t crc;
-	crc = ~0U;
-	while (size--)
-		crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
-	return crc ^ ~0U;
+	return crc32_finish(crc32_append(crc32_start(), buf, size));
 }
 
 // This is added to support incrementally building the crc from several
@@ -116,9 +176,48 @@ uint32_t crc32_start()
     return ~0U;
 }
 
+/* Fold a whole buffer into crc.  Callers should pass data in as large
+ *  pieces as they have rather than byte by byte. */
 uint32_t crc32_append(uint32_t crc, const void *buf, size_t size)
 {
     const uint8_t *p = buf;
+
+#ifdef __aarch64__
+    if(crc32_have_hw())
+        return crc32_append_hw(crc, p, size);
+#endif
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if(size >= CRC32_SLICE_MIN)
+    {
+        if(!crc32_slice_ready)
+            crc32_init_slices();
+
+        // Word loads must be aligned
+        while((uintptr_t)p & 3)
+        {
+            crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+            size--;
+        }
+
+        while(size >= 8)
+        {
+            uint32_t lo = *(const crc32_word_t *)p ^ crc;
+            uint32_t hi = *(const crc32_word_t *)(p + 4);
+            crc = crc32_slice[6][lo & 0xFF] ^
+                crc32_slice[5][(lo >> 8) & 0xFF] ^
+                crc32_slice[4][(lo >> 16) & 0xFF] ^
+                crc32_slice[3][lo >> 24] ^
+                crc32_slice[2][hi & 0xFF] ^
+                crc32_slice[1][(hi >> 8) & 0xFF] ^
+                crc32_slice[0][(hi >> 16) & 0xFF] ^
+                crc32_tab[hi >> 24];
+            p += 8;
+            size -= 8;
+        }
+    }
+#endif
+
     while (size--)
         crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
     return crc;
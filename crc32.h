@@ -20,7 +20,7 @@
  */
 
 #ifndef CRC32_H
-#define CRC32_h
+#define CRC32_H
 
 uint32_t crc32(const void *buf, size_t size);
 uint32_t crc32_start();
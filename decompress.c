@@ -0,0 +1,1099 @@
+/* Copyright (C) 2016 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Streaming decompression of gzip, zlib and LZ4 files
+ *
+ * The decoders pull compressed data from the source file a buffer at a time
+ * and keep the most recent output in a window for back references, so the
+ * caller's buffer can be anywhere (typically the final load address) and
+ * the whole image never needs to be held in memory twice.  Both decoders
+ * can stop after any byte of output and carry on with the next read.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vfs.h"
+#include "fs.h"
+#include "crc32.h"
+#include "util.h"
+#include "decompress.h"
+#ifdef ENABLE_LOAD_PIPELINE
+#include "timer.h"
+#include "loadpipe.h"
+#endif
+
+#define DECOMP_INBUF_SIZE		16384
+#define DECOMP_SCRATCH_SIZE		4096
+
+// Large enough for LZ4 (64 KiB) and deflate (32 KiB) back references
+#define DECOMP_WINDOW_SIZE		65536
+#define DECOMP_WINDOW_MASK		(DECOMP_WINDOW_SIZE - 1)
+
+// Huffman codes up to this length are decoded with a single table lookup
+#define DECOMP_FAST_BITS		9
+
+#define LZ4_MAGIC				0x184D2204
+#define LZ4_LEGACY_MAGIC		0x184C2102
+
+#define LZ4_FLG_BLOCK_CHECKSUM	(1 << 4)
+#define LZ4_FLG_CONTENT_SIZE	(1 << 3)
+#define LZ4_FLG_CONTENT_CHECKSUM	(1 << 2)
+#define LZ4_FLG_DICT_ID			(1 << 0)
+
+#define GZIP_FHCRC				(1 << 1)
+#define GZIP_FEXTRA				(1 << 2)
+#define GZIP_FNAME				(1 << 3)
+#define GZIP_FCOMMENT			(1 << 4)
+
+// Decoder states
+#define DS_HEADER				0	// expecting a block header
+#define DS_STORED				1	// within a deflate stored block
+#define DS_HUFFMAN				2	// within a deflate compressed block
+#define DS_LZ4_TOKEN			3	// expecting an LZ4 sequence token
+#define DS_LZ4_LITERALS			4	// within an LZ4 literal run
+#define DS_LZ4_RAW				5	// within an uncompressed LZ4 block
+#define DS_DONE					6
+#define DS_ERROR				7
+
+struct huffman
+{
+	uint16_t count[16];				// number of codes of each length
+	uint16_t symbol[288];			// symbols ordered by code
+	uint16_t fast[1 << DECOMP_FAST_BITS];	// (length << 9) | symbol
+};
+
+struct decomp
+{
+	struct fs fs;
+	FILE *src;
+	int type;
+	long data_start;				// offset of the compressed data in src
+
+	uint8_t *inbuf;
+	size_t in_pos;
+	size_t in_len;
+	int in_eof;
+	int pad_bytes;					// zeros supplied past the end of src
+
+	uint32_t bitbuf;
+	int bitcnt;
+
+	uint8_t *window;
+	uint32_t wpos;					// total bytes output
+	uint8_t *scratch;
+
+	int state;
+	int last_block;
+	uint32_t left;					// bytes left in a literal run/block
+	uint32_t match_len;
+	uint32_t match_dist;
+	uint32_t block_left;			// compressed bytes left in LZ4 block
+	int token;
+	int lz4_flags;
+
+	struct huffman lencode;
+	struct huffman distcode;
+
+	uint32_t crc;
+	int checked;
+};
+
+static const uint16_t len_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t len_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577 };
+static const uint8_t dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const uint8_t code_length_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static const char *decomp_names[] = { "uncompressed", "gzip", "zlib", "LZ4",
+	"LZ4 legacy" };
+
+int decomp_detect(const uint8_t *buf, size_t len)
+{
+	if((len >= 3) && (buf[0] == 0x1f) && (buf[1] == 0x8b) && (buf[2] == 8))
+		return DECOMP_GZIP;
+	if(len >= 4)
+	{
+		uint32_t magic = read_word(buf, 0);
+		if(magic == LZ4_MAGIC)
+			return DECOMP_LZ4;
+		if(magic == LZ4_LEGACY_MAGIC)
+			return DECOMP_LZ4_LEGACY;
+	}
+
+	// zlib has no real magic number, so only accept the usual 32 KiB window
+	//  deflate header with a valid check value and no preset dictionary
+	if((len >= 2) && (buf[0] == 0x78) && !(buf[1] & 0x20) &&
+			((((uint32_t)buf[0] << 8) | buf[1]) % 31 == 0))
+		return DECOMP_ZLIB;
+
+	return DECOMP_NONE;
+}
+
+const char *decomp_name(int type)
+{
+	if((type < DECOMP_NONE) || (type > DECOMP_LZ4_LEGACY))
+		return "unknown";
+	return decomp_names[type];
+}
+
+static int next_byte(struct decomp *d)
+{
+	if(d->in_pos == d->in_len)
+	{
+		if(d->in_eof)
+			return -1;
+		d->in_len = fread(d->inbuf, 1, DECOMP_INBUF_SIZE, d->src);
+		d->in_pos = 0;
+		if(d->in_len == 0)
+		{
+			d->in_eof = 1;
+			return -1;
+		}
+	}
+	return d->inbuf[d->in_pos++];
+}
+
+static int read_le32(struct decomp *d, uint32_t *val)
+{
+	uint32_t v = 0;
+	for(int i = 0; i < 4; i++)
+	{
+		int b = next_byte(d);
+		if(b < 0)
+			return -1;
+		v |= (uint32_t)b << (i * 8);
+	}
+	*val = v;
+	return 0;
+}
+
+static void need_bits(struct decomp *d, int n)
+{
+	while(d->bitcnt < n)
+	{
+		int b = next_byte(d);
+		if(b < 0)
+		{
+			// Allow peeking past the end, but note it so that a truncated
+			//  stream is detected
+			b = 0;
+			d->pad_bytes++;
+		}
+		d->bitbuf |= (uint32_t)b << d->bitcnt;
+		d->bitcnt += 8;
+	}
+}
+
+static uint32_t get_bits(struct decomp *d, int n)
+{
+	if(n == 0)
+		return 0;
+	need_bits(d, n);
+	uint32_t v = d->bitbuf & ((1U << n) - 1);
+	d->bitbuf >>= n;
+	d->bitcnt -= n;
+	return v;
+}
+
+// Discard bits up to the next byte boundary and return the following byte
+static int aligned_byte(struct decomp *d)
+{
+	d->bitbuf >>= d->bitcnt & 7;
+	d->bitcnt &= ~7;
+	if(d->bitcnt)
+	{
+		int b = (int)(d->bitbuf & 0xff);
+		d->bitbuf >>= 8;
+		d->bitcnt -= 8;
+		return b;
+	}
+	return next_byte(d);
+}
+
+/* Build a canonical Huffman decoding table from a list of code lengths.
+ * Returns 0 for a complete code, > 0 for an incomplete one and < 0 if the
+ * lengths are over-subscribed.
+ */
+static int huff_build(struct huffman *h, const uint8_t *length, int n)
+{
+	uint16_t offs[16];
+
+	memset(h->count, 0, sizeof(h->count));
+	memset(h->fast, 0, sizeof(h->fast));
+	for(int sym = 0; sym < n; sym++)
+		h->count[length[sym]]++;
+	if(h->count[0] == n)
+		return 0;
+
+	int left = 1;
+	for(int len = 1; len < 16; len++)
+	{
+		left <<= 1;
+		left -= h->count[len];
+		if(left < 0)
+			return left;
+	}
+
+	offs[1] = 0;
+	for(int len = 1; len < 15; len++)
+		offs[len + 1] = offs[len] + h->count[len];
+	for(int sym = 0; sym < n; sym++)
+	{
+		if(length[sym])
+			h->symbol[offs[length[sym]]++] = (uint16_t)sym;
+	}
+
+	// Fill in the lookup table for the short codes.  Codes are stored in
+	//  the stream most significant bit first so index by the reversed code.
+	uint32_t code = 0;
+	int idx = 0;
+	for(int len = 1; len <= DECOMP_FAST_BITS; len++)
+	{
+		for(int i = 0; i < h->count[len]; i++, idx++, code++)
+		{
+			uint32_t rev = 0;
+			for(int bit = 0; bit < len; bit++)
+				rev |= ((code >> bit) & 1) << (len - 1 - bit);
+			for(uint32_t j = rev; j < (1U << DECOMP_FAST_BITS); j += 1U << len)
+				h->fast[j] = (uint16_t)((len << 9) | h->symbol[idx]);
+		}
+		code <<= 1;
+	}
+
+	return left;
+}
+
+static int huff_decode(struct decomp *d, struct huffman *h)
+{
+	need_bits(d, DECOMP_FAST_BITS);
+	uint16_t e = h->fast[d->bitbuf & ((1U << DECOMP_FAST_BITS) - 1)];
+	if(e)
+	{
+		int len = e >> 9;
+		d->bitbuf >>= len;
+		d->bitcnt -= len;
+		return e & 0x1ff;
+	}
+
+	// A longer code - decode it a bit at a time
+	int code = 0;
+	int first = 0;
+	int index = 0;
+	for(int len = 1; len < 16; len++)
+	{
+		code |= (int)get_bits(d, 1);
+		int count = h->count[len];
+		if(code - count < first)
+			return h->symbol[index + (code - first)];
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+static int inflate_dynamic_tables(struct decomp *d)
+{
+	uint8_t lengths[320];
+
+	int nlen = (int)get_bits(d, 5) + 257;
+	int ndist = (int)get_bits(d, 5) + 1;
+	int ncode = (int)get_bits(d, 4) + 4;
+	if((nlen > 286) || (ndist > 30))
+		return -1;
+
+	memset(lengths, 0, 19);
+	for(int i = 0; i < ncode; i++)
+		lengths[code_length_order[i]] = (uint8_t)get_bits(d, 3);
+	if(huff_build(&d->lencode, lengths, 19) != 0)
+		return -1;
+
+	int idx = 0;
+	while(idx < nlen + ndist)
+	{
+		int sym = huff_decode(d, &d->lencode);
+		if(sym < 0)
+			return -1;
+		if(sym < 16)
+		{
+			lengths[idx++] = (uint8_t)sym;
+			continue;
+		}
+
+		uint8_t len = 0;
+		int rep;
+		if(sym == 16)
+		{
+			if(idx == 0)
+				return -1;
+			len = lengths[idx - 1];
+			rep = 3 + (int)get_bits(d, 2);
+		}
+		else if(sym == 17)
+			rep = 3 + (int)get_bits(d, 3);
+		else
+			rep = 11 + (int)get_bits(d, 7);
+		if(idx + rep > nlen + ndist)
+			return -1;
+		while(rep--)
+			lengths[idx++] = len;
+	}
+
+	// There must be an end of block code
+	if(lengths[256] == 0)
+		return -1;
+
+	// Incomplete codes are only allowed if they contain a single code
+	int err = huff_build(&d->lencode, lengths, nlen);
+	if((err < 0) || ((err > 0) && (nlen - d->lencode.count[0] != 1)))
+		return -1;
+	err = huff_build(&d->distcode, &lengths[nlen], ndist);
+	if((err < 0) || ((err > 0) && (ndist - d->distcode.count[0] != 1)))
+		return -1;
+
+	return 0;
+}
+
+static int inflate_block_header(struct decomp *d)
+{
+	if(d->last_block)
+	{
+		d->state = DS_DONE;
+		return 0;
+	}
+
+	d->last_block = (int)get_bits(d, 1);
+	switch(get_bits(d, 2))
+	{
+		case 0:
+		{
+			// Stored block
+			d->bitbuf >>= d->bitcnt & 7;
+			d->bitcnt &= ~7;
+			uint32_t len = get_bits(d, 16);
+			uint32_t nlen = get_bits(d, 16);
+			if(len != (~nlen & 0xffff))
+				return -1;
+			d->left = len;
+			d->state = DS_STORED;
+			return 0;
+		}
+
+		case 1:
+		{
+			// Fixed Huffman codes
+			uint8_t lengths[288];
+			int sym = 0;
+			for(; sym < 144; sym++)
+				lengths[sym] = 8;
+			for(; sym < 256; sym++)
+				lengths[sym] = 9;
+			for(; sym < 280; sym++)
+				lengths[sym] = 7;
+			for(; sym < 288; sym++)
+				lengths[sym] = 8;
+			huff_build(&d->lencode, lengths, 288);
+			for(sym = 0; sym < 30; sym++)
+				lengths[sym] = 5;
+			huff_build(&d->distcode, lengths, 30);
+			d->state = DS_HUFFMAN;
+			return 0;
+		}
+
+		case 2:
+			if(inflate_dynamic_tables(d) != 0)
+				return -1;
+			d->state = DS_HUFFMAN;
+			return 0;
+
+		default:
+			return -1;
+	}
+}
+
+static int lz4_byte(struct decomp *d)
+{
+	if(d->block_left == 0)
+		return -1;
+	d->block_left--;
+	return next_byte(d);
+}
+
+static int lz4_length(struct decomp *d, uint32_t *len)
+{
+	int b;
+	do
+	{
+		b = lz4_byte(d);
+		if(b < 0)
+			return -1;
+		*len += (uint32_t)b;
+	} while(b == 255);
+	return 0;
+}
+
+static int lz4_block_header(struct decomp *d)
+{
+	uint32_t size;
+
+	while(1)
+	{
+		if(read_le32(d, &size) != 0)
+		{
+			// Legacy files simply end after the last block
+			if(d->type == DECOMP_LZ4_LEGACY)
+			{
+				d->state = DS_DONE;
+				return 0;
+			}
+			return -1;
+		}
+
+		// Concatenated legacy frames each start with the magic number
+		if((d->type == DECOMP_LZ4_LEGACY) && (size == LZ4_LEGACY_MAGIC))
+			continue;
+		break;
+	}
+
+	if(size == 0)
+	{
+		// End mark (the content checksum, if any, is not checked)
+		d->state = DS_DONE;
+		return 0;
+	}
+
+	if((d->type == DECOMP_LZ4) && (size & 0x80000000))
+	{
+		d->left = size & 0x7fffffff;
+		d->state = DS_LZ4_RAW;
+	}
+	else
+	{
+		d->block_left = size;
+		d->state = DS_LZ4_TOKEN;
+	}
+	return 0;
+}
+
+static int lz4_block_end(struct decomp *d)
+{
+	if(d->lz4_flags & LZ4_FLG_BLOCK_CHECKSUM)
+	{
+		uint32_t checksum;
+		if(read_le32(d, &checksum) != 0)
+			return -1;
+	}
+	d->state = DS_HEADER;
+	return 0;
+}
+
+/* Decode up to len bytes to out.  Returns the number of bytes produced,
+ * which is only less than len at the end of the stream, or -1 on error.
+ */
+static int decomp_produce(struct decomp *d, uint8_t *out, size_t len)
+{
+	size_t n = 0;
+
+	while(n < len)
+	{
+		// Copy out any outstanding back reference first
+		if(d->match_len)
+		{
+			while(d->match_len && (n < len))
+			{
+				uint8_t b = d->window[(d->wpos - d->match_dist) & DECOMP_WINDOW_MASK];
+				d->window[d->wpos++ & DECOMP_WINDOW_MASK] = b;
+				out[n++] = b;
+				d->match_len--;
+			}
+			continue;
+		}
+
+		if(d->pad_bytes > 4)
+			d->state = DS_ERROR;
+
+		int b;
+		switch(d->state)
+		{
+			case DS_HEADER:
+			{
+				int ret;
+				if((d->type == DECOMP_GZIP) || (d->type == DECOMP_ZLIB))
+					ret = inflate_block_header(d);
+				else
+					ret = lz4_block_header(d);
+				if(ret != 0)
+					d->state = DS_ERROR;
+				continue;
+			}
+
+			case DS_STORED:
+				if(d->left == 0)
+				{
+					d->state = DS_HEADER;
+					continue;
+				}
+				b = aligned_byte(d);
+				if(b < 0)
+				{
+					d->state = DS_ERROR;
+					continue;
+				}
+				d->left--;
+				break;
+
+			case DS_HUFFMAN:
+			{
+				int sym = huff_decode(d, &d->lencode);
+				if(sym < 0)
+				{
+					d->state = DS_ERROR;
+					continue;
+				}
+				if(sym < 256)
+				{
+					b = sym;
+					break;
+				}
+				if(sym == 256)
+				{
+					d->state = DS_HEADER;
+					continue;
+				}
+
+				// Length (with its extra bits) then distance
+				sym -= 257;
+				if(sym >= 29)
+				{
+					d->state = DS_ERROR;
+					continue;
+				}
+				uint32_t match_len = len_base[sym] + get_bits(d, len_extra[sym]);
+				int dsym = huff_decode(d, &d->distcode);
+				if((dsym < 0) || (dsym >= 30))
+				{
+					d->state = DS_ERROR;
+					continue;
+				}
+				uint32_t match_dist = dist_base[dsym] + get_bits(d, dist_extra[dsym]);
+				if(match_dist > d->wpos)
+				{
+					d->state = DS_ERROR;
+					continue;
+				}
+				d->match_len = match_len;
+				d->match_dist = match_dist;
+				continue;
+			}
+
+			case DS_LZ4_TOKEN:
+			{
+				d->token = lz4_byte(d);
+				if(d->token < 0)
+				{
+					d->state = DS_ERROR;
+					continue;
+				}
+				d->left = (uint32_t)d->token >> 4;
+				if((d->left == 15) && (lz4_length(d, &d->left) != 0))
+				{
+					d->state = DS_ERROR;
+					continue;
+				}
+				d->state = DS_LZ4_LITERALS;
+				continue;
+			}
+
+			case DS_LZ4_LITERALS:
+			{
+				if(d->left)
+				{
+					b = lz4_byte(d);
+					if(b < 0)
+					{
+						d->state = DS_ERROR;
+						continue;
+					}
+					d->left--;
+					break;
+				}
+
+				// The last sequence of a block has no match
+				if(d->block_left == 0)
+				{
+					if(lz4_block_end(d) != 0)
+						d->state = DS_ERROR;
+					continue;
+				}
+
+				int lo = lz4_byte(d);
+				int hi = lz4_byte(d);
+				uint32_t match_len = (uint32_t)d->token & 0xf;
+				if((lo < 0) || (hi < 0) || ((match_len == 15) &&
+						(lz4_length(d, &match_len) != 0)))
+				{
+					d->state = DS_ERROR;
+					continue;
+				}
+				uint32_t match_dist = (uint32_t)lo | ((uint32_t)hi << 8);
+				if((match_dist == 0) || (match_dist > d->wpos))
+				{
+					d->state = DS_ERROR;
+					continue;
+				}
+				d->match_len = match_len + 4;
+				d->match_dist = match_dist;
+				d->state = DS_LZ4_TOKEN;
+				continue;
+			}
+
+			case DS_LZ4_RAW:
+				if(d->left == 0)
+				{
+					if(lz4_block_end(d) != 0)
+						d->state = DS_ERROR;
+					continue;
+				}
+				b = next_byte(d);
+				if(b < 0)
+				{
+					d->state = DS_ERROR;
+					continue;
+				}
+				d->left--;
+				break;
+
+			case DS_DONE:
+				return (int)n;
+
+			default:
+				return -1;
+		}
+
+		d->window[d->wpos++ & DECOMP_WINDOW_MASK] = (uint8_t)b;
+		out[n++] = (uint8_t)b;
+	}
+
+	return (int)n;
+}
+
+static uint32_t adler32_append(uint32_t adler, const uint8_t *buf, size_t len)
+{
+	uint32_t a = adler & 0xffff;
+	uint32_t b = adler >> 16;
+
+	while(len)
+	{
+		// Largest n such that b cannot overflow before the modulo
+		size_t n = (len > 5552) ? 5552 : len;
+		len -= n;
+		while(n--)
+		{
+			a += *buf++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+static int decomp_read(struct decomp *d, uint8_t *out, size_t len)
+{
+#ifdef ENABLE_LOAD_PIPELINE
+	// Time spent reading the source is accounted for by the load pipe
+	uint32_t io_us = load_stats.io_wait_us + load_stats.copy_us;
+	uint32_t t0 = timer_get_us();
+#endif
+
+	int n = decomp_produce(d, out, len);
+
+#ifdef ENABLE_LOAD_PIPELINE
+	uint32_t t1 = timer_get_us();
+	load_stats.decompress_us += (t1 - t0) -
+		(load_stats.io_wait_us + load_stats.copy_us - io_us);
+#endif
+
+	if(n > 0)
+	{
+		if(d->type == DECOMP_ZLIB)
+			d->crc = adler32_append(d->crc, out, (size_t)n);
+		else
+			d->crc = crc32_append(d->crc, out, (size_t)n);
+#ifdef ENABLE_LOAD_PIPELINE
+		load_stats.crc_us += timer_get_us() - t1;
+#endif
+	}
+	return n;
+}
+
+// Check the gzip or zlib trailer once all the data has been read
+static int decomp_check_trailer(struct decomp *d)
+{
+	if(d->checked || ((d->type != DECOMP_GZIP) && (d->type != DECOMP_ZLIB)))
+		return 0;
+	d->checked = 1;
+
+	// Make sure we have reached the end of the last block
+	if(decomp_produce(d, d->scratch, 1) != 0)
+		return -1;
+
+	uint32_t expected = 0, actual, isize = 0;
+	if(d->type == DECOMP_GZIP)
+	{
+		for(int i = 0; i < 4; i++)
+			expected |= (uint32_t)aligned_byte(d) << (i * 8);
+		for(int i = 0; i < 4; i++)
+			isize |= (uint32_t)aligned_byte(d) << (i * 8);
+		actual = crc32_finish(d->crc);
+	}
+	else
+	{
+		for(int i = 0; i < 4; i++)
+			expected = (expected << 8) | (uint32_t)aligned_byte(d);
+		isize = d->wpos;
+		actual = d->crc;
+	}
+
+	if((expected != actual) || (isize != d->wpos))
+	{
+		printf("DECOMP: %s checksum mismatch (expected %08x, got %08x)\n",
+				decomp_name(d->type), expected, actual);
+		return -1;
+	}
+	return 0;
+}
+
+static int decomp_restart(struct decomp *d)
+{
+	if(fseek(d->src, d->data_start, SEEK_SET) != 0)
+		return -1;
+
+	d->in_pos = 0;
+	d->in_len = 0;
+	d->in_eof = 0;
+	d->pad_bytes = 0;
+	d->bitbuf = 0;
+	d->bitcnt = 0;
+	d->wpos = 0;
+	d->state = DS_HEADER;
+	d->last_block = 0;
+	d->left = 0;
+	d->match_len = 0;
+	d->block_left = 0;
+	d->crc = (d->type == DECOMP_ZLIB) ? 1 : crc32_start();
+	d->checked = 0;
+	return 0;
+}
+
+static int gzip_skip_string(struct decomp *d)
+{
+	int b;
+	do
+	{
+		b = next_byte(d);
+		if(b < 0)
+			return -1;
+	} while(b != 0);
+	return 0;
+}
+
+/* Parse the header of the compressed file, leaving the input positioned at
+ * the start of the compressed data.  Sets *len to the uncompressed length if
+ * the header gives it, else leaves it alone.
+ */
+static int decomp_parse_header(struct decomp *d, long *len)
+{
+	uint8_t hdr[10];
+
+	switch(d->type)
+	{
+		case DECOMP_GZIP:
+		{
+			for(int i = 0; i < 10; i++)
+			{
+				int b = next_byte(d);
+				if(b < 0)
+					return -1;
+				hdr[i] = (uint8_t)b;
+			}
+			uint8_t flags = hdr[3];
+			if(flags & 0xe0)
+				return -1;
+			if(flags & GZIP_FEXTRA)
+			{
+				int lo = next_byte(d);
+				int hi = next_byte(d);
+				if((lo < 0) || (hi < 0))
+					return -1;
+				for(int i = 0; i < (lo | (hi << 8)); i++)
+				{
+					if(next_byte(d) < 0)
+						return -1;
+				}
+			}
+			if((flags & GZIP_FNAME) && (gzip_skip_string(d) != 0))
+				return -1;
+			if((flags & GZIP_FCOMMENT) && (gzip_skip_string(d) != 0))
+				return -1;
+			if(flags & GZIP_FHCRC)
+			{
+				next_byte(d);
+				if(next_byte(d) < 0)
+					return -1;
+			}
+			d->data_start = ftell(d->src) - (long)(d->in_len - d->in_pos);
+
+			// The uncompressed length (mod 2^32) is at the end of the file
+			uint8_t isize[4];
+			fseek(d->src, d->src->len - 4, SEEK_SET);
+			if(fread(isize, 1, 4, d->src) != 4)
+				return -1;
+			*len = (long)read_word(isize, 0);
+			return 0;
+		}
+
+		case DECOMP_ZLIB:
+		{
+			int cmf = next_byte(d);
+			int flg = next_byte(d);
+			if((cmf < 0) || (flg < 0) || ((cmf & 0xf) != 8) ||
+					((cmf >> 4) > 7) || (flg & 0x20) ||
+					((((cmf << 8) | flg) % 31) != 0))
+				return -1;
+			d->data_start = 2;
+			return 0;
+		}
+
+		case DECOMP_LZ4:
+		{
+			uint32_t magic;
+			if(read_le32(d, &magic) != 0)
+				return -1;
+			for(int i = 0; i < 2; i++)
+			{
+				int b = next_byte(d);
+				if(b < 0)
+					return -1;
+				hdr[i] = (uint8_t)b;
+			}
+			d->lz4_flags = hdr[0];
+			if(((hdr[0] >> 6) != 1) || (hdr[0] & LZ4_FLG_DICT_ID))
+			{
+				printf("DECOMP: unsupported LZ4 frame (FLG %02x)\n", hdr[0]);
+				return -1;
+			}
+			if(hdr[0] & LZ4_FLG_CONTENT_SIZE)
+			{
+				uint32_t lo, hi;
+				if((read_le32(d, &lo) != 0) || (read_le32(d, &hi) != 0))
+					return -1;
+				if(hi || (lo & 0x80000000))
+					return -1;
+				*len = (long)lo;
+			}
+
+			// Header checksum
+			if(next_byte(d) < 0)
+				return -1;
+			d->data_start = ftell(d->src) - (long)(d->in_len - d->in_pos);
+			return 0;
+		}
+
+		case DECOMP_LZ4_LEGACY:
+			d->data_start = 4;
+			return 0;
+
+		default:
+			return -1;
+	}
+}
+
+static size_t decomp_fread(struct fs *fs, void *ptr, size_t byte_size, FILE *stream)
+{
+	struct decomp *d = (struct decomp *)stream->opaque;
+	(void)fs;
+
+	int n = decomp_read(d, (uint8_t *)ptr, byte_size);
+	if(n < 0)
+	{
+		printf("DECOMP: corrupt %s data at offset %i\n", decomp_name(d->type),
+				stream->pos);
+		stream->flags |= VFS_FLAGS_ERROR;
+		return 0;
+	}
+	stream->pos += n;
+
+	if((stream->pos == stream->len) && (decomp_check_trailer(d) != 0))
+	{
+		stream->flags |= VFS_FLAGS_ERROR;
+		return 0;
+	}
+
+	return (size_t)n;
+}
+
+static int decomp_fseek(FILE *stream, long offset, int whence)
+{
+	struct decomp *d = (struct decomp *)stream->opaque;
+	long target;
+
+	switch(whence)
+	{
+		case SEEK_SET:
+			target = offset;
+			break;
+		case SEEK_END:
+			target = stream->len - offset;
+			break;
+		case SEEK_CUR:
+			target = stream->pos + offset;
+			break;
+		default:
+			return -1;
+	}
+	if(target < 0)
+		target = 0;
+	if(target > stream->len)
+		target = stream->len;
+
+	// We can only go forwards, so go back to the start if necessary
+	if(target < stream->pos)
+	{
+		if(decomp_restart(d) != 0)
+			return -1;
+		stream->pos = 0;
+	}
+
+	while(stream->pos < target)
+	{
+		size_t to_skip = (size_t)(target - stream->pos);
+		if(to_skip > DECOMP_SCRATCH_SIZE)
+			to_skip = DECOMP_SCRATCH_SIZE;
+		int n = decomp_read(d, d->scratch, to_skip);
+		if(n <= 0)
+			return -1;
+		stream->pos += n;
+	}
+	return 0;
+}
+
+static void decomp_free(struct decomp *d)
+{
+	free(d->inbuf);
+	free(d->window);
+	free(d->scratch);
+	free(d);
+}
+
+static int decomp_fclose(struct fs *fs, FILE *fp)
+{
+	struct decomp *d = (struct decomp *)fp->opaque;
+	(void)fs;
+
+	fclose(d->src);
+	decomp_free(d);
+	fp->opaque = NULL;
+	return 0;
+}
+
+/* Returns a new FILE which reads the decompressed contents of src, which is
+ * then closed along with it.  On failure NULL is returned and src is left
+ * open.
+ */
+FILE *decomp_fopen(FILE *src, int type)
+{
+	struct decomp *d = (struct decomp *)malloc(sizeof(struct decomp));
+	if(d == NULL)
+		return NULL;
+	memset(d, 0, sizeof(struct decomp));
+	d->src = src;
+	d->type = type;
+	d->inbuf = (uint8_t *)malloc(DECOMP_INBUF_SIZE);
+	d->window = (uint8_t *)malloc(DECOMP_WINDOW_SIZE);
+	d->scratch = (uint8_t *)malloc(DECOMP_SCRATCH_SIZE);
+	if(!d->inbuf || !d->window || !d->scratch)
+	{
+		decomp_free(d);
+		return NULL;
+	}
+
+	d->fs.parent = src->fs->parent;
+	d->fs.fs_name = "decompress";
+	d->fs.block_size = DECOMP_SCRATCH_SIZE;
+	d->fs.fread = decomp_fread;
+	d->fs.fclose = decomp_fclose;
+	d->fs.fseek = decomp_fseek;
+
+	long len = -1;
+	fseek(src, 0, SEEK_SET);
+	if((decomp_parse_header(d, &len) != 0) || (decomp_restart(d) != 0))
+	{
+		printf("DECOMP: invalid %s header\n", decomp_name(type));
+		decomp_free(d);
+		return NULL;
+	}
+
+	// If the header doesn't tell us the uncompressed size then decompress
+	//  the whole file once to find out.  This also validates the data.
+	if(len < 0)
+	{
+		int n;
+		len = 0;
+		while((n = decomp_read(d, d->scratch, DECOMP_SCRATCH_SIZE)) > 0)
+			len += n;
+		if((n < 0) || (d->state != DS_DONE) || (decomp_check_trailer(d) != 0) ||
+				(decomp_restart(d) != 0))
+		{
+			printf("DECOMP: corrupt %s data\n", decomp_name(type));
+			decomp_free(d);
+			return NULL;
+		}
+	}
+
+	FILE *ret = (FILE *)malloc(sizeof(struct vfs_file));
+	if(ret == NULL)
+	{
+		decomp_free(d);
+		return NULL;
+	}
+	memset(ret, 0, sizeof(struct vfs_file));
+	ret->fs = &d->fs;
+	ret->pos = 0;
+	ret->mode = VFS_MODE_R;
+	ret->opaque = d;
+	ret->len = len;
+	return ret;
+}
@@ -0,0 +1,49 @@
+/* Copyright (C) 2016 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Transparent decompression of files as they are read
+ *
+ * decomp_fopen() wraps an open file in a new FILE which returns the
+ * decompressed contents.  Data is decoded as it is read, so callers can
+ * fread() straight into the final destination.  Seeking forwards decodes
+ * and discards, seeking backwards restarts from the beginning.
+ */
+
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define DECOMP_NONE			0
+#define DECOMP_GZIP			1
+#define DECOMP_ZLIB			2
+#define DECOMP_LZ4			3	// LZ4 frame format
+#define DECOMP_LZ4_LEGACY	4	// LZ4 legacy format (e.g. lz4 -l, Linux)
+
+int decomp_detect(const uint8_t *buf, size_t len);
+const char *decomp_name(int type);
+FILE *decomp_fopen(FILE *src, int type);
+
+#endif
+
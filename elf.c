@@ -146,3 +146,47 @@ int elf32_load_segment(FILE *fp, Elf32_Phdr *phdr)
 	return ELF_OK;
 }
 
+/* Load a set of regions of the file in a single pass
+ *
+ * The regions are sorted by file offset and read in that order, so the file
+ * is streamed from front to back with each region read directly to its
+ * destination.  The part of each region beyond filesz is zeroed as we go.
+ * The regions array is reordered.
+ */
+int elf32_load_regions(FILE *fp, struct elf32_region *regions, int count)
+{
+	// Insertion sort by file offset - there are only ever a few regions
+	for(int i = 1; i < count; i++)
+	{
+		struct elf32_region r = regions[i];
+		int j = i - 1;
+		while((j >= 0) && (regions[j].offset > r.offset))
+		{
+			regions[j + 1] = regions[j];
+			j--;
+		}
+		regions[j + 1] = r;
+	}
+
+	for(int i = 0; i < count; i++)
+	{
+		struct elf32_region *r = &regions[i];
+		uint8_t *dest = (uint8_t *)r->dest;
+
+		if(r->filesz)
+		{
+			if(ftell(fp) != (long)r->offset)
+				fseek(fp, (long)r->offset, SEEK_SET);
+
+			size_t bytes_read = fread(dest, 1, (size_t)r->filesz, fp);
+			if(bytes_read != (size_t)r->filesz)
+				return ELF_FILE_LOAD_ERROR;
+		}
+
+		if(r->memsz > r->filesz)
+			memset(&dest[r->filesz], 0, r->memsz - r->filesz);
+	}
+
+	return ELF_OK;
+}
+
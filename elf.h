@@ -239,6 +239,17 @@ int elf32_load_section(FILE *fp, Elf32_Shdr *shdr);
 int elf32_read_phdrs(FILE *fp, Elf32_Ehdr *ehdr, uint8_t **phdrs);
 int elf32_load_segment(FILE *fp, Elf32_Phdr *phdr);
 
+// A region of an ELF file to be loaded to memory by elf32_load_regions()
+struct elf32_region
+{
+	uint32_t offset;		// Offset within the file
+	uint32_t filesz;		// Number of bytes to read from the file
+	uint32_t memsz;			// Size in memory, the rest is zeroed
+	void *dest;
+};
+
+int elf32_load_regions(FILE *fp, struct elf32_region *regions, int count);
+
 // Error return from the above functions
 #define ELF_OK				0
 #define ELF_NOT_ELF			-1
@@ -35,10 +35,14 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
 #include "mmio.h"
 #include "block.h"
 #include "timer.h"
 #include "util.h"
+#ifdef ENABLE_PERSIST
+#include "persist.h"
+#endif
 
 #ifdef DEBUG2
 #define EMMC_DEBUG
@@ -73,6 +77,29 @@
 // Enable card interrupts
 //#define SD_CARD_INTERRUPTS
 
+// Use pre-defined length multi-block transfers (CMD23) if the card supports
+//  them
+#define SD_SET_BLOCK_COUNT
+
+// Have the controller send CMD23/CMD12 for multi-block transfers
+#define SD_AUTO_CMD
+
+// Multi-block writes of at least this many blocks are preceded by a
+//  pre-erase hint (ACMD23), 0 to disable
+#define SD_PRE_ERASE_MIN_BLOCKS     32
+
+// Support asynchronous block requests (see block_submit()), with up to this
+//  many requests queued
+#define SD_ASYNC_REQUESTS
+#define SD_QUEUE_DEPTH              8
+
+// Remember the card parameters across warm reboots and, if the card is still
+//  in the state we left it, skip the full initialisation sequence
+#define SD_FAST_INIT
+#ifndef ENABLE_PERSIST
+#undef SD_FAST_INIT
+#endif
+
 // Enable EXPERIMENTAL (and possibly DANGEROUS) SD write support
 #define SD_WRITE_SUPPORT
 
@@ -96,9 +123,14 @@ struct sd_scr
 {
     uint32_t    scr[2];
     uint32_t    sd_bus_widths;
+    uint32_t    sd_cmd_support;
     int         sd_version;
 };
 
+// Bits of the SCR CMD_SUPPORT field
+#define SD_SCR_CMD20_SUPPORT    (1 << 0)
+#define SD_SCR_CMD23_SUPPORT    (1 << 1)
+
 struct emmc_block_dev
 {
 	struct block_device bd;
@@ -125,10 +157,59 @@ struct emmc_block_dev
 	int blocks_to_transfer;
 	size_t block_size;
 	int use_sdma;
+	uint32_t auto_cmd;
 	int card_removal;
 	uint32_t base_clock;
+	uint32_t clock_rate;
+	uint32_t card_csd[4];
+
+#ifdef SD_ASYNC_REQUESTS
+	struct sd_queue
+	{
+		struct block_request *head;
+		struct block_request *tail;
+		int count;
+		int state;
+		int is_write;
+		int cur_block;
+		uint32_t *cur_buf_addr;
+		struct timer_wait timeout;
+	} queue;
+#endif
 };
 
+#ifdef SD_ASYNC_REQUESTS
+// States of the request at the head of the queue
+#define SD_REQ_IDLE         0       // not yet started
+#define SD_REQ_CMD          1       // awaiting command complete
+#define SD_REQ_DATA         2       // awaiting buffer ready
+#define SD_REQ_BUSY         3       // awaiting transfer complete
+#endif
+
+#ifdef SD_FAST_INIT
+// The card parameters saved in the persistent area
+#define SD_PERSIST_TAG      PERSIST_TAG('E', 'M', 'M', 'C')
+
+struct sd_card_params
+{
+	uint32_t emmc_base;
+	uint32_t base_clock;
+	uint32_t clock_rate;
+	uint32_t card_rca;
+	uint32_t card_ocr;
+	uint32_t card_supports_sdhc;
+	uint32_t card_supports_18v;
+	uint32_t bus_width_4bit;
+	uint32_t au_blocks;
+	uint32_t cid[4];
+	uint32_t csd[4];
+	uint32_t scr[2];
+};
+#endif
+
+// Time (system timer value) at which the first read completed
+uint32_t sd_first_read_us = 0;
+
 #define EMMC_BASE		0x20300000
 #define	EMMC_ARG2		0
 #define EMMC_BLKSIZECNT		4
@@ -265,6 +346,11 @@ void emmc_set_base(uint32_t base)
 static char *sd_versions[] = { "unknown", "1.0 and 1.01", "1.10",
     "2.00", "3.0x", "4.xx" };
 
+// Allocation unit sizes in kiB indexed by the AU_SIZE field of the SD Status
+//  (PLSS 4.10.2.4)
+static uint32_t sd_au_sizes[] = { 0, 16, 32, 64, 128, 256, 512, 1024, 2048,
+    4096, 8192, 12288, 16384, 24576, 32768, 65536 };
+
 #ifdef EMMC_DEBUG
 static char *err_irpts[] = { "CMD_TIMEOUT", "CMD_CRC", "CMD_END_BIT", "CMD_INDEX",
 	"DATA_TIMEOUT", "DATA_CRC", "DATA_END_BIT", "CURRENT_LIMIT",
@@ -273,6 +359,10 @@ static char *err_irpts[] = { "CMD_TIMEOUT", "CMD_CRC", "CMD_END_BIT", "CMD_INDEX
 
 int sd_read(struct block_device *, uint8_t *, size_t buf_size, uint32_t);
 int sd_write(struct block_device *, uint8_t *, size_t buf_size, uint32_t);
+#ifdef SD_ASYNC_REQUESTS
+static int sd_submit(struct block_device *, struct block_request *);
+static int sd_poll(struct block_device *);
+#endif
 
 static uint32_t sd_commands[] = {
     SD_CMD_INDEX(0),
@@ -355,7 +445,7 @@ static uint32_t sd_acommands[] = {
     SD_CMD_RESERVED(10),
     SD_CMD_RESERVED(11),
     SD_CMD_RESERVED(12),
-    SD_CMD_INDEX(13) | SD_RESP_R1,
+    SD_CMD_INDEX(13) | SD_RESP_R1 | SD_DATA_READ,
     SD_CMD_RESERVED(14),
     SD_CMD_RESERVED(15),
     SD_CMD_RESERVED(16),
@@ -790,6 +880,29 @@ static int sd_reset_dat()
 	return 0;
 }
 
+// Move one block between the buffer and the data port, returning the
+//  position of the next block in the buffer
+static uint32_t *sd_transfer_block(struct emmc_block_dev *dev, uint32_t *cur_buf_addr, int is_write)
+{
+    size_t cur_byte_no = 0;
+    while(cur_byte_no < dev->block_size)
+    {
+        if(is_write)
+        {
+            uint32_t data = read_word((uint8_t *)cur_buf_addr, 0);
+            mmio_write(emmc_base + EMMC_DATA, data);
+        }
+        else
+        {
+            uint32_t data = mmio_read(emmc_base + EMMC_DATA);
+            write_word(data, (uint8_t *)cur_buf_addr, 0);
+        }
+        cur_byte_no += 4;
+        cur_buf_addr++;
+    }
+    return cur_buf_addr;
+}
+
 static void sd_issue_command_int(struct emmc_block_dev *dev, uint32_t cmd_reg, uint32_t argument, useconds_t timeout)
 {
     dev->last_cmd_reg = cmd_reg;
@@ -850,6 +963,16 @@ static void sd_issue_command_int(struct emmc_block_dev *dev, uint32_t cmd_reg, u
     uint32_t blksizecnt = dev->block_size | (dev->blocks_to_transfer << 16);
     mmio_write(emmc_base + EMMC_BLKSIZECNT, blksizecnt);
 
+    // Let the controller terminate multi-block transfers if requested
+    if(cmd_reg & SD_CMD_MULTI_BLOCK)
+    {
+        cmd_reg |= dev->auto_cmd;
+
+        // Auto CMD23 takes its argument (the block count) from ARG2
+        if(dev->auto_cmd == SD_CMD_AUTO_CMD_EN_CMD23)
+            mmio_write(emmc_base + EMMC_ARG2, dev->blocks_to_transfer);
+    }
+
     // Set argument 1 reg
     mmio_write(emmc_base + EMMC_ARG1, argument);
 
@@ -937,22 +1060,7 @@ static void sd_issue_command_int(struct emmc_block_dev *dev, uint32_t cmd_reg, u
             }
 
             // Transfer the block
-            size_t cur_byte_no = 0;
-            while(cur_byte_no < dev->block_size)
-            {
-                if(is_write)
-				{
-					uint32_t data = read_word((uint8_t *)cur_buf_addr, 0);
-                    mmio_write(emmc_base + EMMC_DATA, data);
-				}
-                else
-				{
-					uint32_t data = mmio_read(emmc_base + EMMC_DATA);
-					write_word(data, (uint8_t *)cur_buf_addr, 0);
-				}
-                cur_byte_no += 4;
-                cur_buf_addr++;
-            }
+            cur_buf_addr = sd_transfer_block(dev, cur_buf_addr, is_write);
 
 #ifdef EMMC_DEBUG
 			printf("SD: block %i transfer complete\n", cur_block);
@@ -1283,6 +1391,267 @@ static void sd_issue_command(struct emmc_block_dev *dev, uint32_t command, uint3
 #endif
 }
 
+// Decode the fields we use from the raw SCR
+static void sd_parse_scr(struct sd_scr *scr)
+{
+	// Note that the SCR is big-endian
+	uint32_t scr0 = byte_swap(scr->scr[0]);
+	scr->sd_version = SD_VER_UNKNOWN;
+	uint32_t sd_spec = (scr0 >> (56 - 32)) & 0xf;
+	uint32_t sd_spec3 = (scr0 >> (47 - 32)) & 0x1;
+	uint32_t sd_spec4 = (scr0 >> (42 - 32)) & 0x1;
+	scr->sd_bus_widths = (scr0 >> (48 - 32)) & 0xf;
+	scr->sd_cmd_support = (scr0 >> (32 - 32)) & 0xf;
+	if(sd_spec == 0)
+        scr->sd_version = SD_VER_1;
+    else if(sd_spec == 1)
+        scr->sd_version = SD_VER_1_1;
+    else if(sd_spec == 2)
+    {
+        if(sd_spec3 == 0)
+            scr->sd_version = SD_VER_2;
+        else if(sd_spec3 == 1)
+        {
+            if(sd_spec4 == 0)
+                scr->sd_version = SD_VER_3;
+            else if(sd_spec4 == 1)
+                scr->sd_version = SD_VER_4;
+        }
+    }
+}
+
+// Set up a device structure (reusing *dev if provided)
+static struct emmc_block_dev *sd_alloc_device(struct block_device **dev, uint32_t base_clock)
+{
+	struct emmc_block_dev *ret;
+	if(*dev == NULL)
+		ret = (struct emmc_block_dev *)malloc(sizeof(struct emmc_block_dev));
+	else
+		ret = (struct emmc_block_dev *)*dev;
+
+	assert(ret);
+
+#ifdef SD_ASYNC_REQUESTS
+	// Keep any queued requests if we are re-initialising
+	struct sd_queue queue;
+	if(*dev == NULL)
+		memset(&queue, 0, sizeof(struct sd_queue));
+	else
+		queue = ret->queue;
+#endif
+
+	memset(ret, 0, sizeof(struct emmc_block_dev));
+	ret->bd.driver_name = driver_name;
+	ret->bd.device_name = device_name;
+	ret->bd.block_size = 512;
+	ret->bd.read = sd_read;
+#ifdef SD_WRITE_SUPPORT
+    ret->bd.write = sd_write;
+#endif
+    ret->bd.supports_multiple_block_read = 1;
+    ret->bd.supports_multiple_block_write = 1;
+#ifdef SD_ASYNC_REQUESTS
+	ret->bd.submit = sd_submit;
+	ret->bd.poll = sd_poll;
+	ret->bd.queue_depth = SD_QUEUE_DEPTH;
+	ret->queue = queue;
+#endif
+	ret->base_clock = base_clock;
+
+	return ret;
+}
+
+#ifdef SD_FAST_INIT
+static void sd_save_card_params(struct emmc_block_dev *edev)
+{
+	struct sd_card_params p;
+	memset(&p, 0, sizeof(struct sd_card_params));
+	p.emmc_base = emmc_base;
+	p.base_clock = edev->base_clock;
+	p.clock_rate = edev->clock_rate;
+	p.card_rca = edev->card_rca;
+	p.card_ocr = edev->card_ocr;
+	p.card_supports_sdhc = edev->card_supports_sdhc;
+	p.card_supports_18v = edev->card_supports_18v;
+	p.bus_width_4bit = (mmio_read(emmc_base + EMMC_CONTROL0) & 0x2) ? 1 : 0;
+	p.au_blocks = edev->bd.au_blocks;
+	memcpy(p.cid, edev->bd.device_id, sizeof(p.cid));
+	memcpy(p.csd, edev->card_csd, sizeof(p.csd));
+	memcpy(p.scr, edev->scr->scr, sizeof(p.scr));
+
+	if(persist_set(SD_PERSIST_TAG, &p, sizeof(struct sd_card_params)) != 0)
+		printf("SD: unable to save card parameters\n");
+}
+
+// Check the response to CMD9/CMD10 matches the saved value
+static int sd_check_r2(struct emmc_block_dev *edev, uint32_t *expected)
+{
+	return (edev->last_r0 == expected[0]) && (edev->last_r1 == expected[1]) &&
+		(edev->last_r2 == expected[2]) && (edev->last_r3 == expected[3]);
+}
+
+// Attempt to take over a card left initialised by the previous boot (e.g.
+//  across a watchdog reboot), using the parameters saved by
+//  sd_save_card_params().  The card must still answer to the saved RCA and
+//  return the saved CID and CSD, otherwise we return -1 and the caller runs
+//  the full initialisation sequence.
+static int sd_card_fast_init(struct block_device **dev)
+{
+	size_t p_len;
+	struct sd_card_params *p = (struct sd_card_params *)persist_get(SD_PERSIST_TAG,
+		&p_len);
+	if((p == NULL) || (p_len != sizeof(struct sd_card_params)))
+		return -1;
+	if(p->emmc_base != emmc_base)
+		return -1;
+
+	uint32_t ver = mmio_read(emmc_base + EMMC_SLOTISR_VER);
+	hci_ver = (ver >> 16) & 0xff;
+	capabilities_0 = mmio_read(emmc_base + EMMC_CAPABILITIES_0);
+	capabilities_1 = mmio_read(emmc_base + EMMC_CAPABILITIES_1);
+
+	// The card must be present and the SD clock still running
+	if((mmio_read(emmc_base + EMMC_STATUS) & (1 << 16)) == 0)
+		return -1;
+	if((mmio_read(emmc_base + EMMC_CONTROL1) & 0x7) != 0x7)
+		return -1;
+
+	// The signalling voltage cannot be changed without a power cycle
+	uint32_t control0 = mmio_read(emmc_base + EMMC_CONTROL0);
+	if(((control0 >> 8) & 0x1) != p->card_supports_18v)
+		return -1;
+
+	// Set up interrupts as per the full initialisation
+	mmio_write(emmc_base + EMMC_IRPT_EN, 0);
+	mmio_write(emmc_base + EMMC_INTERRUPT, 0xffffffff);
+	uint32_t irpt_mask = 0xffffffff & (~SD_CARD_INTERRUPT);
+#ifdef SD_CARD_INTERRUPTS
+    irpt_mask |= SD_CARD_INTERRUPT;
+#endif
+	mmio_write(emmc_base + EMMC_IRPT_MASK, irpt_mask);
+
+	if(sd_reset_cmd() != 0)
+		return -1;
+	if(sd_reset_dat() != 0)
+		return -1;
+
+	struct emmc_block_dev *ret = sd_alloc_device(dev, p->base_clock);
+	ret->card_rca = p->card_rca;
+	ret->card_ocr = p->card_ocr;
+	ret->card_supports_sdhc = p->card_supports_sdhc;
+	ret->card_supports_18v = p->card_supports_18v;
+	ret->block_size = 512;
+
+	// Is the card still there at the same address?
+	sd_issue_command(ret, SEND_STATUS, ret->card_rca << 16, 50000);
+	if(FAIL(ret))
+	{
+		sd_reset_cmd();
+		goto fail;
+	}
+	uint32_t cur_state = (ret->last_r0 >> 9) & 0xf;
+
+	if((cur_state == 5) || (cur_state == 6))
+	{
+		// Interrupted in the middle of a transfer
+		sd_issue_command(ret, STOP_TRANSMISSION, 0, 500000);
+		if(FAIL(ret))
+			goto fail;
+		sd_reset_dat();
+		cur_state = 4;
+	}
+
+	if(cur_state == 4)
+	{
+		// Deselect the card so that we can read its CID and CSD.  Only the
+		//  selected card responds to CMD7, so there is no response to a
+		//  deselect.
+		sd_issue_command(ret, DESELECT_CARD, 0, 50000);
+		if(CMD_TIMEOUT(ret))
+		{
+			if(sd_reset_cmd() == -1)
+				goto fail;
+			mmio_write(emmc_base + EMMC_INTERRUPT, SD_ERR_MASK_CMD_TIMEOUT);
+		}
+		else if(FAIL(ret))
+			goto fail;
+	}
+	else if(cur_state != 3)
+		goto fail;
+
+	// Check it is the same card
+	sd_issue_command(ret, SEND_CID, ret->card_rca << 16, 500000);
+	if(FAIL(ret) || !sd_check_r2(ret, p->cid))
+		goto fail;
+	sd_issue_command(ret, SEND_CSD, ret->card_rca << 16, 500000);
+	if(FAIL(ret) || !sd_check_r2(ret, p->csd))
+		goto fail;
+	memcpy(ret->card_csd, p->csd, sizeof(ret->card_csd));
+
+	// Select it again
+	sd_issue_command(ret, SELECT_CARD, ret->card_rca << 16, 500000);
+	if(FAIL(ret))
+		goto fail;
+	cur_state = (ret->last_r0 >> 9) & 0xf;
+	if((cur_state != 3) && (cur_state != 4))
+		goto fail;
+
+	if(!ret->card_supports_sdhc)
+	{
+	    sd_issue_command(ret, SET_BLOCKLEN, 512, 500000);
+	    if(FAIL(ret))
+	        goto fail;
+	}
+	uint32_t controller_block_size = mmio_read(emmc_base + EMMC_BLKSIZECNT);
+	controller_block_size &= (~0xfff);
+	controller_block_size |= 0x200;
+	mmio_write(emmc_base + EMMC_BLKSIZECNT, controller_block_size);
+
+	// Restore the bus width and clock rate
+	sd_issue_command(ret, SET_BUS_WIDTH, p->bus_width_4bit ? 0x2 : 0x0, 500000);
+	if(FAIL(ret))
+		goto fail;
+	control0 = mmio_read(emmc_base + EMMC_CONTROL0);
+	if(p->bus_width_4bit)
+		control0 |= 0x2;
+	else
+		control0 &= ~0x2;
+	mmio_write(emmc_base + EMMC_CONTROL0, control0);
+
+	if(sd_switch_clock_rate(ret->base_clock, p->clock_rate) != 0)
+		goto fail;
+	ret->clock_rate = p->clock_rate;
+
+	ret->scr = (struct sd_scr *)malloc(sizeof(struct sd_scr));
+	ret->scr->scr[0] = p->scr[0];
+	ret->scr->scr[1] = p->scr[1];
+	sd_parse_scr(ret->scr);
+
+	uint32_t *dev_id = (uint32_t *)malloc(4 * sizeof(uint32_t));
+	memcpy(dev_id, p->cid, 4 * sizeof(uint32_t));
+	ret->bd.device_id = (uint8_t *)dev_id;
+	ret->bd.dev_id_len = 4 * sizeof(uint32_t);
+	ret->bd.au_blocks = p->au_blocks;
+
+	printf("SD: found a valid version %s SD card (using saved parameters)\n",
+		sd_versions[ret->scr->sd_version]);
+
+	mmio_write(emmc_base + EMMC_INTERRUPT, 0xffffffff);
+
+	*dev = (struct block_device *)ret;
+	return 0;
+
+fail:
+#ifdef EMMC_DEBUG
+	printf("SD: saved card parameters do not match, performing full "
+		"initialisation\n");
+#endif
+	if(*dev == NULL)
+		free(ret);
+	return -1;
+}
+#endif
+
 int sd_card_init(struct block_device **dev)
 {
     // Check the sanity of the sd_commands and sd_acommands structures
@@ -1301,6 +1670,17 @@ int sd_card_init(struct block_device **dev)
         return -1;
     }
 
+#ifdef SD_FAST_INIT
+	// Skip the power cycle and full initialisation sequence if the card is
+	//  still initialised from the previous boot.  Not after a failed voltage
+	//  switch as we have already power cycled the card.
+	if((*dev == NULL) || !((struct emmc_block_dev *)*dev)->failed_voltage_switch)
+	{
+		if(sd_card_fast_init(dev) == 0)
+			return 0;
+	}
+#endif
+
 #if SDHCI_IMPLEMENTATION == SDHCI_IMPLEMENTATION_BCM_2708
 	// Power cycle the card to ensure its in its startup state
 	if(bcm_2708_power_cycle() != 0)
@@ -1447,25 +1827,7 @@ int sd_card_init(struct block_device **dev)
 	usleep(2000);
 
     // Prepare the device structure
-	struct emmc_block_dev *ret;
-	if(*dev == NULL)
-		ret = (struct emmc_block_dev *)malloc(sizeof(struct emmc_block_dev));
-	else
-		ret = (struct emmc_block_dev *)*dev;
-
-	assert(ret);
-
-	memset(ret, 0, sizeof(struct emmc_block_dev));
-	ret->bd.driver_name = driver_name;
-	ret->bd.device_name = device_name;
-	ret->bd.block_size = 512;
-	ret->bd.read = sd_read;
-#ifdef SD_WRITE_SUPPORT
-    ret->bd.write = sd_write;
-#endif
-    ret->bd.supports_multiple_block_read = 1;
-    ret->bd.supports_multiple_block_write = 1;
-	ret->base_clock = base_clock;
+	struct emmc_block_dev *ret = sd_alloc_device(dev, base_clock);
 
 #ifdef EMMC_DEBUG
 	printf("EMMC: device structure created\n");
@@ -1615,6 +1977,7 @@ int sd_card_init(struct block_device **dev)
     // At this point, we know the card is definitely an SD card, so will definitely
 	//  support SDR12 mode which runs at 25 MHz
     sd_switch_clock_rate(base_clock, SD_CLOCK_NORMAL);
+    ret->clock_rate = SD_CLOCK_NORMAL;
 
 	// A small wait before the voltage switch
 	usleep(5000);
@@ -1783,6 +2146,19 @@ int sd_card_init(struct block_device **dev)
 	printf("SD: RCA: %04x\n", ret->card_rca);
 #endif
 
+	// Get the CSD whilst still in the stand-by state
+	sd_issue_command(ret, SEND_CSD, ret->card_rca << 16, 500000);
+	if(FAIL(ret))
+	{
+	    printf("SD: error sending SEND_CSD\n");
+	    free(ret);
+	    return -1;
+	}
+	ret->card_csd[0] = ret->last_r0;
+	ret->card_csd[1] = ret->last_r1;
+	ret->card_csd[2] = ret->last_r2;
+	ret->card_csd[3] = ret->last_r3;
+
 	// Now select the card (toggles it to transfer state)
 	sd_issue_command(ret, SELECT_CARD, ret->card_rca << 16, 500000);
 	if(FAIL(ret))
@@ -1836,36 +2212,15 @@ int sd_card_init(struct block_device **dev)
 	}
 
 	// Determine card version
-	// Note that the SCR is big-endian
-	uint32_t scr0 = byte_swap(ret->scr->scr[0]);
-	ret->scr->sd_version = SD_VER_UNKNOWN;
-	uint32_t sd_spec = (scr0 >> (56 - 32)) & 0xf;
-	uint32_t sd_spec3 = (scr0 >> (47 - 32)) & 0x1;
-	uint32_t sd_spec4 = (scr0 >> (42 - 32)) & 0x1;
-	ret->scr->sd_bus_widths = (scr0 >> (48 - 32)) & 0xf;
-	if(sd_spec == 0)
-        ret->scr->sd_version = SD_VER_1;
-    else if(sd_spec == 1)
-        ret->scr->sd_version = SD_VER_1_1;
-    else if(sd_spec == 2)
-    {
-        if(sd_spec3 == 0)
-            ret->scr->sd_version = SD_VER_2;
-        else if(sd_spec3 == 1)
-        {
-            if(sd_spec4 == 0)
-                ret->scr->sd_version = SD_VER_3;
-            else if(sd_spec4 == 1)
-                ret->scr->sd_version = SD_VER_4;
-        }
-    }
+	sd_parse_scr(ret->scr);
 
 #ifdef EMMC_DEBUG
     printf("SD: &scr: %08x\n", &ret->scr->scr[0]);
     printf("SD: SCR[0]: %08x, SCR[1]: %08x\n", ret->scr->scr[0], ret->scr->scr[1]);;
     printf("SD: SCR: %08x%08x\n", byte_swap(ret->scr->scr[0]), byte_swap(ret->scr->scr[1]));
-    printf("SD: SCR: version %s, bus_widths %01x\n", sd_versions[ret->scr->sd_version],
-           ret->scr->sd_bus_widths);
+    printf("SD: SCR: version %s, bus_widths %01x, cmd_support %01x\n",
+           sd_versions[ret->scr->sd_version], ret->scr->sd_bus_widths,
+           ret->scr->sd_cmd_support);
 #endif
 
     if(ret->scr->sd_bus_widths & 0x4)
@@ -1903,6 +2258,26 @@ int sd_card_init(struct block_device **dev)
 #endif
     }
 
+    // Get the allocation unit size from the SD Status so that large writes
+    //  can be split at AU boundaries
+    uint32_t sd_status[16];
+    ret->buf = &sd_status[0];
+    ret->block_size = 64;
+    ret->blocks_to_transfer = 1;
+    sd_issue_command(ret, SD_STATUS, 0, 500000);
+    ret->block_size = 512;
+    if(FAIL(ret))
+        printf("SD: error sending SD_STATUS\n");
+    else
+    {
+        // The SD Status is big-endian, AU_SIZE is bits 431:428
+        uint32_t au_size = (((uint8_t *)sd_status)[10] >> 4) & 0xf;
+        ret->bd.au_blocks = sd_au_sizes[au_size] * 1024 / 512;
+#ifdef EMMC_DEBUG
+        printf("SD: AU_SIZE %i (%i blocks)\n", au_size, ret->bd.au_blocks);
+#endif
+    }
+
 	printf("SD: found a valid version %s SD card\n", sd_versions[ret->scr->sd_version]);
 #ifdef EMMC_DEBUG
 	printf("SD: setup successful (status %i)\n", status);
@@ -1911,6 +2286,10 @@ int sd_card_init(struct block_device **dev)
 	// Reset interrupt register
 	mmio_write(emmc_base + EMMC_INTERRUPT, 0xffffffff);
 
+#ifdef SD_FAST_INIT
+	sd_save_card_params(ret);
+#endif
+
 	*dev = (struct block_device *)ret;
 
 	return 0;
@@ -1958,6 +2337,9 @@ static int sd_ensure_data_mode(struct emmc_block_dev *edev)
 	else if(cur_state == 5)
 	{
 		// In the data transfer state - cancel the transmission
+		// Multi-block transfers normally terminate themselves (see
+		//  sd_set_block_count()) so we only get here after an error or
+		//  if neither CMD23 nor Auto CMD12 is available
 		sd_issue_command(edev, STOP_TRANSMISSION, 0, 500000);
 		if(FAIL(edev))
 		{
@@ -2020,11 +2402,52 @@ static int sd_suitable_for_dma(void *buf)
 }
 #endif
 
-static int sd_do_data_command(struct emmc_block_dev *edev, int is_write, uint8_t *buf, size_t buf_size, uint32_t block_no)
+// Arrange for a multi-block transfer to stop after blocks_to_transfer blocks
+//  rather than being open-ended.  Cards supporting CMD23 are told the block
+//  count up front, otherwise the controller sends CMD12 after the last block.
+//  Either way the card returns to the transfer state on its own and
+//  sd_ensure_data_mode() does not have to stop the transmission.
+static int sd_set_block_count(struct emmc_block_dev *edev)
+{
+	edev->auto_cmd = SD_CMD_AUTO_CMD_EN_NONE;
+	if(edev->blocks_to_transfer <= 1)
+		return 0;
+
+#ifdef SD_SET_BLOCK_COUNT
+	if(edev->scr && (edev->scr->sd_cmd_support & SD_SCR_CMD23_SUPPORT))
+	{
+#ifdef SD_AUTO_CMD
+		// Auto CMD23 needs a version 3 host and shares ARG2 with SDMA
+		if((hci_ver >= 2) && !edev->use_sdma)
+		{
+			edev->auto_cmd = SD_CMD_AUTO_CMD_EN_CMD23;
+			return 0;
+		}
+#endif
+		sd_issue_command(edev, SET_BLOCK_COUNT, edev->blocks_to_transfer,
+			500000);
+		if(FAIL(edev))
+		{
+			printf("SD: error sending SET_BLOCK_COUNT\n");
+			return -1;
+		}
+		return 0;
+	}
+#endif
+
+#ifdef SD_AUTO_CMD
+	edev->auto_cmd = SD_CMD_AUTO_CMD_EN_CMD12;
+#endif
+	return 0;
+}
+
+// Set up edev for a data transfer, returning the command to use (or -1)
+//  and adjusting *block_no to the card's addressing mode
+static int sd_prepare_data_command(struct emmc_block_dev *edev, int is_write, uint8_t *buf, size_t buf_size, uint32_t *block_no)
 {
 	// PLSS table 4.20 - SDSC cards use byte addresses rather than block addresses
 	if(!edev->card_supports_sdhc)
-		block_no *= 512;
+		*block_no *= 512;
 
 	// This is as per HCSS 3.7.2.1
 	if(buf_size < edev->block_size)
@@ -2060,6 +2483,35 @@ static int sd_do_data_command(struct emmc_block_dev *edev, int is_write, uint8_t
             command = READ_SINGLE_BLOCK;
     }
 
+	return command;
+}
+
+// Let the card erase the blocks we are about to write in advance.  This is
+//  only a hint so failure is not fatal.
+static void sd_pre_erase(struct emmc_block_dev *edev, int is_write)
+{
+#if SD_PRE_ERASE_MIN_BLOCKS > 0
+    if(is_write && (edev->blocks_to_transfer >= SD_PRE_ERASE_MIN_BLOCKS))
+    {
+        sd_issue_command(edev, SET_WR_BLK_ERASE_COUNT,
+            edev->blocks_to_transfer & 0x7fffff, 500000);
+#ifdef EMMC_DEBUG
+        if(FAIL(edev))
+            printf("SD: error sending SET_WR_BLK_ERASE_COUNT\n");
+#endif
+    }
+#else
+    (void)edev;
+    (void)is_write;
+#endif
+}
+
+static int sd_do_data_command(struct emmc_block_dev *edev, int is_write, uint8_t *buf, size_t buf_size, uint32_t block_no)
+{
+	int command = sd_prepare_data_command(edev, is_write, buf, buf_size, &block_no);
+	if(command < 0)
+		return -1;
+
 	int retry_count = 0;
 	int max_retries = 3;
 	while(retry_count < max_retries)
@@ -2079,7 +2531,11 @@ static int sd_do_data_command(struct emmc_block_dev *edev, int is_write, uint8_t
         edev->use_sdma = 0;
 #endif
 
-        sd_issue_command(edev, command, block_no, 5000000);
+        sd_pre_erase(edev, is_write);
+
+        if(sd_set_block_count(edev) == 0)
+            sd_issue_command(edev, command, block_no, 5000000);
+        edev->auto_cmd = SD_CMD_AUTO_CMD_EN_NONE;
 
         if(SUCCESS(edev))
             break;
@@ -2107,6 +2563,10 @@ int sd_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t bl
 {
 	// Check the status of the card
 	struct emmc_block_dev *edev = (struct emmc_block_dev *)dev;
+#ifdef SD_ASYNC_REQUESTS
+    // Let any queued requests finish first
+    while(sd_poll(dev));
+#endif
     if(sd_ensure_data_mode(edev) != 0)
         return -1;
 
@@ -2117,6 +2577,9 @@ int sd_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t bl
     if(sd_do_data_command(edev, 0, buf, buf_size, block_no) < 0)
         return -1;
 
+    if(sd_first_read_us == 0)
+        sd_first_read_us = timer_get_us();
+
 #ifdef EMMC_DEBUG
 	printf("SD: data read successful\n");
 #endif
@@ -2129,6 +2592,9 @@ int sd_write(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t b
 {
 	// Check the status of the card
 	struct emmc_block_dev *edev = (struct emmc_block_dev *)dev;
+#ifdef SD_ASYNC_REQUESTS
+    while(sd_poll(dev));
+#endif
     if(sd_ensure_data_mode(edev) != 0)
         return -1;
 
@@ -2147,3 +2613,228 @@ int sd_write(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t b
 }
 #endif
 
+#ifdef SD_ASYNC_REQUESTS
+/* Asynchronous requests
+ *
+ * Requests are queued on the device and started one at a time.  sd_poll()
+ * advances the request at the head of the queue through the same steps as
+ * sd_issue_command_int() without waiting at any of them, so the caller can
+ * do other work whilst the card is busy.  A request which fails is retried
+ * synchronously via sd_do_data_command().
+ */
+
+static void sd_req_complete(struct emmc_block_dev *edev, int result)
+{
+    struct block_request *req = edev->queue.head;
+    edev->queue.head = req->next;
+    if(edev->queue.head == NULL)
+        edev->queue.tail = NULL;
+    edev->queue.count--;
+    edev->queue.state = SD_REQ_IDLE;
+    edev->auto_cmd = SD_CMD_AUTO_CMD_EN_NONE;
+
+    if((result >= 0) && !req->is_write && (sd_first_read_us == 0))
+        sd_first_read_us = timer_get_us();
+
+    block_complete(req, result);
+}
+
+static void sd_req_retry(struct emmc_block_dev *edev)
+{
+    struct block_request *req = edev->queue.head;
+
+#ifdef EMMC_DEBUG
+    printf("SD: asynchronous request failed (interrupts %08x), retrying\n",
+        edev->last_interrupt);
+#endif
+
+    sd_reset_cmd();
+    sd_reset_dat();
+    mmio_write(emmc_base + EMMC_INTERRUPT, 0xffffffff);
+    edev->auto_cmd = SD_CMD_AUTO_CMD_EN_NONE;
+
+    int result = -1;
+    if((sd_ensure_data_mode(edev) == 0) && (sd_do_data_command(edev,
+        req->is_write, req->buf, req->buf_size, req->block_num) == 0))
+        result = (int)req->buf_size;
+    sd_req_complete(edev, result);
+}
+
+// Issue the command for the request at the head of the queue
+static void sd_req_start(struct emmc_block_dev *edev)
+{
+    struct block_request *req = edev->queue.head;
+
+    if(sd_ensure_data_mode(edev) != 0)
+    {
+        sd_req_complete(edev, -1);
+        return;
+    }
+
+    uint32_t block_no = req->block_num;
+    int command = sd_prepare_data_command(edev, req->is_write, req->buf,
+        req->buf_size, &block_no);
+    if(command < 0)
+    {
+        sd_req_complete(edev, -1);
+        return;
+    }
+    edev->use_sdma = 0;
+
+    sd_pre_erase(edev, req->is_write);
+    if(sd_set_block_count(edev) != 0)
+    {
+        sd_req_retry(edev);
+        return;
+    }
+
+    sd_handle_interrupts(edev);
+    if(edev->card_removal)
+    {
+        sd_req_complete(edev, -1);
+        return;
+    }
+
+    // Wait for the command and data lines to be free
+    TIMEOUT_WAIT((mmio_read(emmc_base + EMMC_STATUS) & 0x3) == 0, 1000000);
+    if(mmio_read(emmc_base + EMMC_STATUS) & 0x3)
+    {
+#ifdef EMMC_DEBUG
+        printf("SD: command/data lines still busy, failing request\n");
+#endif
+        sd_reset_cmd();
+        sd_reset_dat();
+        sd_req_complete(edev, -1);
+        return;
+    }
+
+    uint32_t cmd_reg = sd_commands[command] | edev->auto_cmd;
+    mmio_write(emmc_base + EMMC_BLKSIZECNT, edev->block_size |
+        (edev->blocks_to_transfer << 16));
+    if(edev->auto_cmd == SD_CMD_AUTO_CMD_EN_CMD23)
+        mmio_write(emmc_base + EMMC_ARG2, edev->blocks_to_transfer);
+    mmio_write(emmc_base + EMMC_ARG1, block_no);
+
+    edev->last_cmd = command;
+    edev->last_cmd_reg = cmd_reg;
+    edev->last_cmd_success = 0;
+    edev->queue.is_write = req->is_write;
+    edev->queue.cur_block = 0;
+    edev->queue.cur_buf_addr = (uint32_t *)req->buf;
+    edev->queue.state = SD_REQ_CMD;
+    edev->queue.timeout = register_timer(5000000);
+
+    mmio_write(emmc_base + EMMC_CMDTM, cmd_reg);
+}
+
+static int sd_submit(struct block_device *dev, struct block_request *req)
+{
+    struct emmc_block_dev *edev = (struct emmc_block_dev *)dev;
+
+    if(edev->queue.count >= SD_QUEUE_DEPTH)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    req->next = NULL;
+    if(edev->queue.tail)
+        edev->queue.tail->next = req;
+    else
+        edev->queue.head = req;
+    edev->queue.tail = req;
+    edev->queue.count++;
+
+    // Get it started if the controller is idle
+    sd_poll(dev);
+    return 0;
+}
+
+static int sd_poll(struct block_device *dev)
+{
+    struct emmc_block_dev *edev = (struct emmc_block_dev *)dev;
+
+    while(edev->queue.head)
+    {
+        struct block_request *req = edev->queue.head;
+        uint32_t irpts = mmio_read(emmc_base + EMMC_INTERRUPT);
+        uint32_t ready = edev->queue.is_write ? SD_BUFFER_WRITE_READY :
+            SD_BUFFER_READ_READY;
+
+        switch(edev->queue.state)
+        {
+            case SD_REQ_IDLE:
+                sd_req_start(edev);
+                continue;
+
+            case SD_REQ_CMD:
+                if((irpts & 0x8001) == 0)
+                    break;
+                mmio_write(emmc_base + EMMC_INTERRUPT, 0xffff0001);
+                if((irpts & 0xffff0001) != 0x1)
+                {
+                    edev->last_error = irpts & 0xffff0000;
+                    edev->last_interrupt = irpts;
+                    sd_req_retry(edev);
+                    continue;
+                }
+                edev->last_r0 = mmio_read(emmc_base + EMMC_RESP0);
+                edev->queue.state = SD_REQ_DATA;
+                edev->queue.timeout = register_timer(5000000);
+                continue;
+
+            case SD_REQ_DATA:
+                if((irpts & (ready | 0x8000)) == 0)
+                    break;
+                mmio_write(emmc_base + EMMC_INTERRUPT, 0xffff0000 | ready);
+                if((irpts & (0xffff0000 | ready)) != ready)
+                {
+                    edev->last_error = irpts & 0xffff0000;
+                    edev->last_interrupt = irpts;
+                    sd_req_retry(edev);
+                    continue;
+                }
+                edev->queue.cur_buf_addr = sd_transfer_block(edev,
+                    edev->queue.cur_buf_addr, edev->queue.is_write);
+                if(++edev->queue.cur_block == edev->blocks_to_transfer)
+                    edev->queue.state = SD_REQ_BUSY;
+                edev->queue.timeout = register_timer(5000000);
+                continue;
+
+            case SD_REQ_BUSY:
+                // Handle the case where both data timeout and transfer
+                //  complete are set as per sd_issue_command_int()
+                if(mmio_read(emmc_base + EMMC_STATUS) & 0x2)
+                {
+                    if((irpts & 0x8002) == 0)
+                        break;
+                    if(((irpts & 0xffff0002) != 0x2) &&
+                        ((irpts & 0xffff0002) != 0x100002))
+                    {
+                        mmio_write(emmc_base + EMMC_INTERRUPT, 0xffff0002);
+                        edev->last_error = irpts & 0xffff0000;
+                        edev->last_interrupt = irpts;
+                        sd_req_retry(edev);
+                        continue;
+                    }
+                }
+                mmio_write(emmc_base + EMMC_INTERRUPT, 0xffff0002);
+                edev->last_cmd_success = 1;
+                sd_req_complete(edev, (int)req->buf_size);
+                continue;
+        }
+
+        // Nothing more can be done until the card is ready
+        if(compare_timer(edev->queue.timeout))
+        {
+            edev->last_error = 0;
+            edev->last_interrupt = irpts;
+            sd_req_retry(edev);
+            continue;
+        }
+        break;
+    }
+
+    return edev->queue.count;
+}
+#endif
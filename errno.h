@@ -32,6 +32,7 @@ extern int errno;
 #define EROFS		-6
 #define ERANGE		-7
 #define ENOSPC		-8
+#define EBUSY		-9
 
 #endif
 
@@ -274,6 +274,7 @@ static FILE *ext2_fopen(struct fs *fs, struct dirent *path, const char *mode)
 	struct ext2_inode *inode = ext2_read_inode(ext2,
 			(uintptr_t)path->opaque);
 	ret->len = (long)inode->size;	// no support for large files
+	ret->mtime = inode->last_modification_time;
 	free(inode);
 
 	return ret;
@@ -301,6 +302,22 @@ static size_t ext2_fread(struct fs *fs, void *ptr, size_t byte_size, FILE *strea
 	return fs_fread(ext2_get_next_bdev_block_num, fs, ptr, byte_size, stream, (void *)inode);
 }
 
+static int ext2_fmap(FILE *fp, long offset, size_t max_length, uint32_t *block_num, size_t *length)
+{
+	if(fp->opaque == (void *)0)
+		return -1;
+
+	struct ext2_inode *inode = ext2_read_inode((struct ext2_fs *)fp->fs,
+		(uintptr_t)fp->opaque);
+	if(inode == (void *)0)
+		return -1;
+
+	int ret = fs_fmap(ext2_get_next_bdev_block_num, fp->fs, fp, offset, max_length,
+		block_num, length, (void *)inode);
+	free(inode);
+	return ret;
+}
+
 static int ext2_fclose(struct fs *fs, FILE *fp)
 {
 	(void)fs;
@@ -370,6 +387,7 @@ int ext2_init(struct block_device *parent, struct fs **fs)
 	ret->b.fopen = ext2_fopen;
 	ret->b.fread = ext2_fread;
 	ret->b.fclose = ext2_fclose;
+	ret->b.fmap = ext2_fmap;
 	ret->b.read_directory = ext2_read_directory;
 	ret->b.parent = parent;
 	ret->b.fs_name = ext2_name;
@@ -118,6 +118,15 @@ struct fat_file_block_offset
 	uint32_t cluster;
 };
 
+// Per-file state.  The position reached in the cluster chain by the last
+//  read is remembered so that reading a file front to back (with forward
+//  seeks) only walks the chain once.
+struct fat_file
+{
+	uint32_t first_cluster;
+	struct fat_file_block_offset cursor;
+};
+
 static const char *fat_names[] = { "FAT12", "FAT16", "FAT32", "VFAT" };
 
 static FILE *fat_fopen(struct fs *fs, struct dirent *path, const char *mode)
@@ -134,12 +143,25 @@ static FILE *fat_fopen(struct fs *fs, struct dirent *path, const char *mode)
 		return (FILE *)0;
 	}
 
+	// Empty files have no clusters allocated
+	if((path->opaque == (void *)0) && (path->byte_size != 0))
+	{
+		errno = EFAULT;
+		return (FILE *)0;
+	}
+
+	struct fat_file *ff = (struct fat_file *)malloc(sizeof(struct fat_file));
+	ff->first_cluster = (uintptr_t)path->opaque;
+	ff->cursor.cluster = ff->first_cluster;
+	ff->cursor.f_block = 0;
+
 	struct vfs_file *ret = (struct vfs_file *)malloc(sizeof(struct vfs_file));
 	memset(ret, 0, sizeof(struct vfs_file));
 	ret->fs = fs;
 	ret->pos = 0;
-	ret->opaque = path->opaque;
+	ret->opaque = ff;
 	ret->len = (long)path->byte_size;
+	ret->mtime = path->mtime;
 
 	(void)mode;
 	return ret;
@@ -152,16 +174,56 @@ static size_t fat_fread(struct fs *fs, void *ptr, size_t byte_size, FILE *stream
 	if(stream->opaque == (void *)0)
 		return -1;
 
-	struct fat_file_block_offset opaque;
-	opaque.cluster = (uintptr_t)stream->opaque;
-	opaque.f_block = 0;
-	return fs_fread(fat_get_next_bdev_block_num, fs, ptr, byte_size, stream, (void*)&opaque);
+	// Continue from the last position in the cluster chain if we can,
+	//  else start again from the beginning
+	struct fat_file *ff = (struct fat_file *)stream->opaque;
+	if(byte_size == 0)
+		return 0;
+	if((ff->first_cluster == 0) ||
+			((long)(stream->pos + byte_size) > stream->len))
+	{
+		// Past the end of the file (all of an empty one is)
+		errno = EFAULT;
+		return -1;
+	}
+
+	struct fat_file_block_offset opaque = ff->cursor;
+	if(opaque.f_block > (uint32_t)stream->pos / fs->block_size)
+	{
+		opaque.cluster = ff->first_cluster;
+		opaque.f_block = 0;
+	}
+
+	size_t ret = fs_fread(fat_get_next_bdev_block_num, fs, ptr, byte_size, stream, (void*)&opaque);
+
+	if(opaque.cluster < 0x0ffffff8)
+		ff->cursor = opaque;
+	return ret;
+}
+
+static int fat_fmap(FILE *fp, long offset, size_t max_length, uint32_t *block_num, size_t *length)
+{
+	struct fat_file *ff = (struct fat_file *)fp->opaque;
+	struct fat_file_block_offset opaque = ff->cursor;
+	if(opaque.f_block > (uint32_t)offset / fp->fs->block_size)
+	{
+		opaque.cluster = ff->first_cluster;
+		opaque.f_block = 0;
+	}
+
+	int ret = fs_fmap(fat_get_next_bdev_block_num, fp->fs, fp, offset, max_length,
+		block_num, length, (void*)&opaque);
+
+	if(opaque.cluster < 0x0ffffff8)
+		ff->cursor = opaque;
+	return ret;
 }
 
 static int fat_fclose(struct fs *fs, FILE *fp)
 {
 	(void)fs;
-	(void)fp;
+	free(fp->opaque);
+	fp->opaque = (void *)0;
 	return 0;
 }
 
@@ -220,6 +282,7 @@ int fat_init(struct block_device *parent, struct fs **fs)
 	ret->b.fopen = fat_fopen;
 	ret->b.fread = fat_fread;
 	ret->b.fclose = fat_fclose;
+	ret->b.fmap = fat_fmap;
 	ret->b.read_directory = fat_read_directory;
 	ret->b.parent = parent;
 
@@ -535,6 +598,8 @@ struct dirent *fat_read_dir(struct fat_fs *fs, struct dirent *d)
 				de->is_dir = 1;
 			de->next = (void *)0;
 			de->byte_size = read_word(buf, ptr + 28);
+			de->mtime = ((uint32_t)read_halfword(buf, ptr + 24) << 16) |
+				read_halfword(buf, ptr + 22);
 			uintptr_t opaque = read_halfword(buf, ptr + 26) | 
 				((uint32_t)read_halfword(buf, ptr + 20) << 16);
 
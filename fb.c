@@ -60,9 +60,15 @@
 #define TAG_TEST_PALETTE		0x4400b
 #define TAG_SET_PALETTE			0x4800b
 
+/* The virtual framebuffer is this many screens tall, so the console can
+ *  scroll by moving the virtual offset rather than copying the screen */
+#define FB_VIRT_SCREENS			2
+
 static uint32_t phys_w, phys_h, virt_w, virt_h, pitch;
 static uintptr_t fb_addr, fb_size;
 
+static int fb_allocate(volatile uint32_t *mailbuffer, uintptr_t mb_addr);
+
 int fb_init()
 {
 	// define a mailbox buffer
@@ -106,10 +112,49 @@ int fb_init()
 	if((phys_w == 0) || (phys_h == 0))
 		return FB_FAIL_INVALID_RESOLUTION;
 
-	/* For now set the physical and virtual sizes to be the same */
+	/* Try for a taller virtual framebuffer, but fall back to one the same
+	 *  size as the display if the firmware cannot provide it */
 	virt_w = phys_w;
-	virt_h = phys_h;
+	virt_h = phys_h * FB_VIRT_SCREENS;
+
+	int ret = fb_allocate(mailbuffer, mb_addr);
+	if((ret != 0) && (virt_h != phys_h))
+	{
+		virt_h = phys_h;
+		ret = fb_allocate(mailbuffer, mb_addr);
+	}
+	if(ret != 0)
+		return ret;
+
+	/* Get the pitch of the display */
+	mailbuffer[0] = 7 * 4;
+	mailbuffer[1] = 0;
+
+	mailbuffer[2] = TAG_GET_PITCH;
+	mailbuffer[3] = 4;
+	mailbuffer[4] = 0;
+	mailbuffer[5] = 0;
+
+	mailbuffer[6] = 0;
+
+	mbox_write(MBOX_PROP, mb_addr);
+	mbox_read(MBOX_PROP);
+
+	/* Validate the response */
+	if(mailbuffer[1] != MBOX_SUCCESS)
+		return FB_FAIL_INVALID_PITCH_RESPONSE;
+	if(mailbuffer[4] != (MBOX_SUCCESS | 4))
+		return FB_FAIL_INVALID_PITCH_RESPONSE;
+
+	pitch = mailbuffer[5];
+	if(pitch == 0)
+		return FB_FAIL_INVALID_PITCH_DATA;
+
+	return 0;
+}
 
+static int fb_allocate(volatile uint32_t *mailbuffer, uintptr_t mb_addr)
+{
 	/* Now set the physical and virtual sizes and bit depth and allocate the framebuffer */
 	mailbuffer[0] = 22 * 4;		// size of buffer
 	mailbuffer[1] = 0;		// request
@@ -156,30 +201,39 @@ int fb_init()
 	if((fb_addr == 0) || (fb_size == 0))
 		return FB_FAIL_INVALID_TAG_DATA;
 
-	/* Get the pitch of the display */
-	mailbuffer[0] = 7 * 4;
+	/* The firmware may have given a different virtual height */
+	virt_h = mailbuffer[11];
+	if(virt_h < phys_h)
+		return FB_FAIL_INVALID_TAG_DATA;
+
+	return 0;
+}
+
+/* Set which line of the virtual framebuffer is at the top of the display */
+int fb_set_virt_offset(int y)
+{
+	uintptr_t mb_addr = 0x7000;
+	volatile uint32_t *mailbuffer = (uint32_t *)mb_addr;
+
+	if((y < 0) || ((uint32_t)y + phys_h > virt_h))
+		return -1;
+
+	mailbuffer[0] = 8 * 4;
 	mailbuffer[1] = 0;
 
-	mailbuffer[2] = TAG_GET_PITCH;
-	mailbuffer[3] = 4;
-	mailbuffer[4] = 0;
+	mailbuffer[2] = TAG_SET_VIRT_OFFSET;
+	mailbuffer[3] = 8;
+	mailbuffer[4] = 8;
 	mailbuffer[5] = 0;
+	mailbuffer[6] = (uint32_t)y;
 
-	mailbuffer[6] = 0;
+	mailbuffer[7] = 0;
 
 	mbox_write(MBOX_PROP, mb_addr);
 	mbox_read(MBOX_PROP);
 
-	/* Validate the response */
 	if(mailbuffer[1] != MBOX_SUCCESS)
-		return FB_FAIL_INVALID_PITCH_RESPONSE;
-	if(mailbuffer[4] != (MBOX_SUCCESS | 4))
-		return FB_FAIL_INVALID_PITCH_RESPONSE;
-
-	pitch = mailbuffer[5];
-	if(pitch == 0)
-		return FB_FAIL_INVALID_PITCH_DATA;
-
+		return -1;
 	return 0;
 }
 
@@ -193,12 +247,19 @@ int fb_get_byte_size()
 	return virt_w * virt_h * BYTES_PER_PIXEL;
 }
 
+// The visible size of the display
 int fb_get_width()
 {
-	return virt_w;
+	return phys_w;
 }
 
 int fb_get_height()
+{
+	return phys_h;
+}
+
+// The height of the whole framebuffer, see fb_set_virt_offset()
+int fb_get_virt_height()
 {
 	return virt_h;
 }
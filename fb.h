@@ -38,6 +38,8 @@ int fb_get_byte_size();
 int fb_get_width();
 int fb_get_height();
 int fb_get_pitch();
+int fb_get_virt_height();
+int fb_set_virt_offset(int y);
 
 #endif
 
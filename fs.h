@@ -44,6 +44,10 @@ struct fs {
 	long (*ftell)(FILE *fp);
 	int (*fflush)(FILE *fp);
 
+	// Optional: find the location on parent of the data at a file offset,
+	//  see fs_fmap()
+	int (*fmap)(FILE *fp, long offset, size_t max_length, uint32_t *block_num, size_t *length);
+
 	struct dirent *(*read_directory)(struct fs *, char **name);
 };
 
@@ -55,6 +59,9 @@ size_t fs_fread(uint32_t (*get_next_bdev_block_num)(uint32_t f_block_idx, FILE *
 size_t fs_fwrite(uint32_t (*get_next_bdev_block_num)(uint32_t f_block_idx, FILE *s, void *opaque, int add_blocks),
 	struct fs *fs, void *ptr, size_t byte_size,
 	FILE *stream, void *opaque);
+int fs_fmap(uint32_t (*get_next_bdev_block_num)(uint32_t f_block_idx, FILE *s, void *opaque, int add_blocks),
+	struct fs *fs, FILE *stream, long offset, size_t max_length,
+	uint32_t *block_num, size_t *length, void *opaque);
 
 #endif
 
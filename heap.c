@@ -22,6 +22,14 @@
 #include <stdint.h>
 #include <stdio.h>
 
+/* The heap runs from the end of the image to MAX_BRK, i.e. 960 KiB less the
+ * size of rpi-boot itself.  The largest users are:
+ *	console shadow buffer	rows * cols * 2 bytes (63 KiB at 1920x1080)
+ *	console glyphs		16 KiB at 16 bits per pixel
+ *	load pipeline		192 KiB while a file is loaded
+ *	decompressor		84 KiB while a compressed file is loaded
+ * so with the default configuration at most about 360 KiB of it is taken by
+ * these at once. */
 #define MAX_BRK (((uintptr_t)&_start - 0x8000) + 0xf0000)
 
 #ifdef ENABLE_USB
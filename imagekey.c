@@ -0,0 +1,93 @@
+/* Copyright (C) 2016 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* A key identifying the contents of a file without reading all of it, used
+ * to decide whether a copy of an image made on a previous boot can be used.
+ * It combines the file's device and path, its length, the device block it
+ * starts at, its modification time and a CRC of its first and last
+ * IMAGE_KEY_SAMPLE bytes.  The modification time is what catches a file
+ * rebuilt in place at the same size, so files on filesystems which don't
+ * record one (nofs, ramdisks) get no key and are always loaded normally.
+ * FAT only keeps the time to 2 seconds, but a rebuild within 2 seconds of
+ * the previous one would also have to leave the sampled bytes unchanged.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "crc32.h"
+#include "imagekey.h"
+#include "vfs.h"
+
+#define IMAGE_KEY_SAMPLE	4096
+
+static uint32_t sample_crc(FILE *fp, uint32_t crc, long offset, size_t length)
+{
+	uint8_t *buf = (uint8_t *)malloc(length);
+	if(!buf)
+		return crc;
+
+	fseek(fp, offset, SEEK_SET);
+	size_t bytes_read = fread(buf, 1, length, fp);
+	crc = crc32_append(crc, buf, bytes_read);
+	free(buf);
+	return crc;
+}
+
+// Build the key for a file that is about to be loaded.  fp is left at the
+//  start of the file.  Returns -1 if the file cannot be identified reliably,
+//  in which case no copy of it must be reused.
+int image_key(FILE *fp, const char *path, struct image_key *key)
+{
+	if(fp->mtime == 0)
+		return -1;
+	key->mtime = fp->mtime;
+
+	const char *dev = fp->fs->parent->device_name;
+	uint32_t crc = crc32_start();
+	crc = crc32_append(crc, dev, strlen(dev));
+	crc = crc32_append(crc, ":", 1);
+	crc = crc32_append(crc, path, strlen(path));
+	key->path_crc = crc32_finish(crc);
+
+	key->file_len = (uint32_t)fp->len;
+
+	uint32_t block_num;
+	size_t length;
+	if(fp->fs->fmap && (fp->fs->fmap(fp, 0, 1, &block_num, &length) == 0))
+		key->first_block = block_num;
+	else
+		key->first_block = 0xffffffff;
+
+	// The start and end of the file overlap for small files
+	size_t sample = IMAGE_KEY_SAMPLE;
+	if(key->file_len < sample)
+		sample = key->file_len;
+	crc = crc32_start();
+	crc = sample_crc(fp, crc, 0, sample);
+	crc = sample_crc(fp, crc, (long)(key->file_len - sample), sample);
+	key->sample_crc = crc32_finish(crc);
+
+	fseek(fp, 0, SEEK_SET);
+	return 0;
+}
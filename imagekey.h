@@ -0,0 +1,41 @@
+/* Copyright (C) 2016 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef IMAGEKEY_H
+#define IMAGEKEY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Identifies a file without reading all of it
+struct image_key
+{
+	uint32_t path_crc;		// of the device name and path
+	uint32_t file_len;
+	uint32_t first_block;	// on the device, if the filesystem can tell us
+	uint32_t mtime;			// modification time, as struct dirent
+	uint32_t sample_crc;	// of the start and end of the file
+};
+
+int image_key(FILE *fp, const char *path, struct image_key *key);
+
+#endif
@@ -0,0 +1,419 @@
+/* Copyright (C) 2016 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* The partition starts with an index (IMGCACHE_INDEX_SIZE bytes), followed
+ * by the images, each starting on a block boundary.  Images are identified
+ * by their image_key and checked against the CRC of the loaded image, so a
+ * stale or damaged copy is never used.
+ *
+ * Each image loaded on this boot is recorded with imgcache_add().  Before
+ * the kernel is started imgcache_update() writes any which weren't in the
+ * cache to blocks which no image in the current index uses, so the current
+ * index stays valid.  The new index is not written yet: it is kept in the
+ * persistent area until the kernel reports that it booted, through
+ * confirm_boot() in the functions table (see imgcache_confirm()).  The next
+ * boot's imgcache_open() then writes it to the partition if it was
+ * confirmed, or discards it and keeps the current index if not.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "block.h"
+#include "crc32.h"
+#include "imgcache.h"
+#include "persist.h"
+#include "vfs.h"
+
+#ifdef DEBUG2
+#define IMGCACHE_DEBUG
+#endif
+
+#define IMGCACHE_MAGIC			0x43494252		// 'RBIC'
+#define IMGCACHE_VERSION		2
+#define IMGCACHE_MAX			32
+#define IMGCACHE_INDEX_SIZE		4096
+#define IMGCACHE_PERSIST_TAG	PERSIST_TAG('I', 'C', 'P', 'N')
+#define IMGCACHE_NAME_LEN		32
+
+struct imgcache_entry
+{
+	struct image_key key;
+	uint32_t start_block;
+	uint32_t length;
+	uint32_t crc;				// of the image
+};
+
+struct imgcache_index
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t crc;				// of entries[0..count)
+	struct imgcache_entry entries[IMGCACHE_MAX];
+};
+
+// The index written by the last boot, waiting for the kernel to confirm it
+struct imgcache_pending
+{
+	uint32_t confirmed;
+	char dev_name[IMGCACHE_NAME_LEN];
+	struct imgcache_index index;
+};
+
+// Images loaded on this boot
+struct imgcache_image
+{
+	struct imgcache_entry e;
+	uint32_t addr;
+	int cached;					// already in the cache at e.start_block
+};
+
+static struct block_device *cache_dev = NULL;
+static char cache_name[IMGCACHE_NAME_LEN];
+static struct imgcache_index *cache_index = NULL;
+static struct imgcache_image images[IMGCACHE_MAX];
+static int image_count = 0;
+
+static uint32_t index_crc(const struct imgcache_index *idx)
+{
+	return crc32(idx->entries, idx->count * sizeof(struct imgcache_entry));
+}
+
+static uint32_t length_blocks(uint32_t length)
+{
+	return (length + cache_dev->block_size - 1) / cache_dev->block_size;
+}
+
+// Use the partition containing the filesystem registered as dev_name
+int imgcache_open(const char *dev_name)
+{
+	struct block_device *dev = vfs_get_block_device(dev_name);
+	if(!dev)
+	{
+		printf("IMGCACHE: no device %s\n", dev_name);
+		return -1;
+	}
+	if(strlen(dev_name) >= IMGCACHE_NAME_LEN)
+	{
+		printf("IMGCACHE: device name %s is too long\n", dev_name);
+		return -1;
+	}
+	if((dev->block_size == 0) || (IMGCACHE_INDEX_SIZE % dev->block_size) ||
+			(dev->num_blocks <= IMGCACHE_INDEX_SIZE / dev->block_size))
+	{
+		printf("IMGCACHE: %s is not suitable for an image cache\n", dev_name);
+		return -1;
+	}
+
+	struct imgcache_index *idx = (struct imgcache_index *)malloc(IMGCACHE_INDEX_SIZE);
+	if(!idx)
+		return -1;
+	if(block_read(dev, (uint8_t *)idx, IMGCACHE_INDEX_SIZE, 0) != IMGCACHE_INDEX_SIZE)
+	{
+		printf("IMGCACHE: unable to read the index on %s\n", dev_name);
+		free(idx);
+		return -1;
+	}
+
+	// Start with an empty cache if the index isn't valid
+	if((idx->magic != IMGCACHE_MAGIC) || (idx->version != IMGCACHE_VERSION) ||
+			(idx->count > IMGCACHE_MAX) || (index_crc(idx) != idx->crc))
+	{
+		printf("IMGCACHE: no valid index on %s, starting a new cache\n",
+				dev_name);
+		memset(idx, 0, IMGCACHE_INDEX_SIZE);
+	}
+
+	// Write the index left by the last boot if its kernel confirmed it
+	size_t pending_len;
+	struct imgcache_pending *p = (struct imgcache_pending *)persist_get(
+			IMGCACHE_PERSIST_TAG, &pending_len);
+	if(p && (pending_len == sizeof(struct imgcache_pending)) &&
+			!strcmp(p->dev_name, dev_name))
+	{
+		if(p->confirmed && (p->index.count <= IMGCACHE_MAX))
+		{
+			memset(idx, 0, IMGCACHE_INDEX_SIZE);
+			memcpy(idx, &p->index, sizeof(struct imgcache_index));
+			if(block_write(dev, (uint8_t *)idx, IMGCACHE_INDEX_SIZE, 0) !=
+					IMGCACHE_INDEX_SIZE)
+				printf("IMGCACHE: error writing the index\n");
+			else
+				printf("IMGCACHE: cache updated with %i image(s)\n",
+						idx->count);
+		}
+		else
+			printf("IMGCACHE: last boot was not confirmed, keeping the previous images\n");
+	}
+	if(p)
+		persist_remove(IMGCACHE_PERSIST_TAG);
+
+	if(cache_index)
+		free(cache_index);
+	cache_index = idx;
+	cache_dev = dev;
+	strcpy(cache_name, dev_name);
+	image_count = 0;
+
+#ifdef IMGCACHE_DEBUG
+	printf("IMGCACHE: %i image(s) in cache on %s\n", cache_index->count, dev_name);
+#endif
+	return 0;
+}
+
+// Return the index of the cached copy of the image with the given key, and
+//  its length, or -1 if there is none
+int imgcache_lookup(const struct image_key *key, uint32_t *length)
+{
+	if(!cache_index)
+		return -1;
+
+	for(uint32_t i = 0; i < cache_index->count; i++)
+	{
+		if(!memcmp(&cache_index->entries[i].key, key, sizeof(struct image_key)))
+		{
+			*length = cache_index->entries[i].length;
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+// Read a cached image to dest, which must hold the length returned by
+//  imgcache_lookup().  Returns 0 on success or -1 if the copy is bad.
+int imgcache_read(int idx, void *dest)
+{
+	struct imgcache_entry *e = &cache_index->entries[idx];
+	size_t block_size = cache_dev->block_size;
+	size_t whole = e->length - e->length % block_size;
+	uint8_t *d = (uint8_t *)dest;
+
+	if(e->start_block + length_blocks(e->length) > cache_dev->num_blocks)
+		return -1;
+
+	// All the complete blocks in one read, then the last partial block
+	//  through a bounce buffer so nothing beyond the image is written
+	if(whole && (block_read(cache_dev, d, whole, e->start_block) != whole))
+		return -1;
+	if(whole < e->length)
+	{
+		uint8_t *buf = (uint8_t *)malloc(block_size);
+		if(!buf)
+			return -1;
+		size_t ret = block_read(cache_dev, buf, block_size,
+				e->start_block + whole / block_size);
+		memcpy(&d[whole], buf, e->length - whole);
+		free(buf);
+		if(ret != block_size)
+			return -1;
+	}
+
+	if(crc32(dest, e->length) != e->crc)
+	{
+		printf("IMGCACHE: cached image at block %i is damaged\n",
+				e->start_block);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Record an image loaded on this boot, from the cache or otherwise
+void imgcache_add(const struct image_key *key, uint32_t addr, uint32_t length)
+{
+	if(!cache_index || (image_count >= IMGCACHE_MAX))
+		return;
+
+	struct imgcache_image *img = &images[image_count++];
+	img->e.key = *key;
+	img->e.length = length;
+	img->e.crc = crc32((const void *)(uintptr_t)addr, length);
+	img->addr = addr;
+
+	// Is it already there?
+	uint32_t cached_len;
+	int i = imgcache_lookup(key, &cached_len);
+	img->cached = (i >= 0) && (cached_len == length) &&
+		(cache_index->entries[i].crc == img->e.crc);
+	img->e.start_block = img->cached ? cache_index->entries[i].start_block : 0;
+}
+
+static int write_image(struct imgcache_image *img)
+{
+	size_t block_size = cache_dev->block_size;
+	size_t whole = img->e.length - img->e.length % block_size;
+	uint8_t *src = (uint8_t *)(uintptr_t)img->addr;
+
+	if(whole && (block_write(cache_dev, src, whole, img->e.start_block) != whole))
+		return -1;
+	if(whole < img->e.length)
+	{
+		uint8_t *buf = (uint8_t *)malloc(block_size);
+		if(!buf)
+			return -1;
+		memset(buf, 0, block_size);
+		memcpy(buf, &src[whole], img->e.length - whole);
+		size_t ret = block_write(cache_dev, buf, block_size,
+				img->e.start_block + whole / block_size);
+		free(buf);
+		if(ret != block_size)
+			return -1;
+	}
+	return 0;
+}
+
+// Is [start, start + count) clear of the images in the current index and
+//  of those of images[0..placed) which are being written?
+static int range_free(uint32_t start, uint32_t count, int placed)
+{
+	for(uint32_t i = 0; i < cache_index->count; i++)
+	{
+		struct imgcache_entry *e = &cache_index->entries[i];
+		if((start < e->start_block + length_blocks(e->length)) &&
+				(e->start_block < start + count))
+			return 0;
+	}
+	for(int i = 0; i < placed; i++)
+	{
+		struct imgcache_entry *e = &images[i].e;
+		if(!images[i].cached && (start < e->start_block + length_blocks(e->length)) &&
+				(e->start_block < start + count))
+			return 0;
+	}
+	return 1;
+}
+
+// Find the lowest free run of count blocks.  A run can only start at the
+//  start of the data area or just after an image.  Returns 0 if there is none.
+static uint32_t find_space(uint32_t count, int placed)
+{
+	uint32_t best = 0;
+	for(int i = -1; i < (int)cache_index->count + placed; i++)
+	{
+		uint32_t start;
+		if(i < 0)
+			start = IMGCACHE_INDEX_SIZE / cache_dev->block_size;
+		else if(i < (int)cache_index->count)
+			start = cache_index->entries[i].start_block +
+				length_blocks(cache_index->entries[i].length);
+		else
+		{
+			struct imgcache_image *img = &images[i - cache_index->count];
+			if(img->cached)
+				continue;
+			start = img->e.start_block + length_blocks(img->e.length);
+		}
+
+		if((start + count > cache_dev->num_blocks) || (best && (start >= best)))
+			continue;
+		if(range_free(start, count, placed))
+			best = start;
+	}
+	return best;
+}
+
+// Lay out the images which need writing in the space not used by the current
+//  index, which must stay valid until the new one is confirmed.  Returns -1
+//  if they don't fit.
+static int place_images(void)
+{
+	for(int i = 0; i < image_count; i++)
+	{
+		if(images[i].cached)
+			continue;
+		images[i].e.start_block = find_space(length_blocks(images[i].e.length), i);
+		if(images[i].e.start_block == 0)
+			return -1;
+	}
+	return 0;
+}
+
+// Write the images loaded on this boot which aren't in the cache, and keep
+//  the new index in the persistent area until the kernel confirms it.  This
+//  is called before the kernel is entered, so nothing is known of whether it
+//  will boot.
+void imgcache_update(void)
+{
+	if(!cache_index)
+		return;
+
+	int changed = (cache_index->count != (uint32_t)image_count);
+	for(int i = 0; i < image_count; i++)
+	{
+		if(!images[i].cached)
+			changed = 1;
+	}
+	if(!changed)
+		return;
+
+	if(place_images() != 0)
+	{
+		printf("IMGCACHE: not enough free space in the cache\n");
+		return;
+	}
+
+	for(int i = 0; i < image_count; i++)
+	{
+		if(images[i].cached)
+			continue;
+		if(write_image(&images[i]) != 0)
+		{
+			printf("IMGCACHE: error writing to the cache\n");
+			return;
+		}
+	}
+
+	struct imgcache_pending *p = (struct imgcache_pending *)persist_alloc(
+			IMGCACHE_PERSIST_TAG, sizeof(struct imgcache_pending));
+	if(!p)
+	{
+		printf("IMGCACHE: unable to store the new index\n");
+		return;
+	}
+	strcpy(p->dev_name, cache_name);
+	p->index.magic = IMGCACHE_MAGIC;
+	p->index.version = IMGCACHE_VERSION;
+	p->index.count = (uint32_t)image_count;
+	for(int i = 0; i < image_count; i++)
+		p->index.entries[i] = images[i].e;
+	p->index.crc = index_crc(&p->index);
+	persist_commit(p);
+
+	printf("IMGCACHE: %i image(s) will be cached once the kernel confirms the boot\n",
+			image_count);
+}
+
+// Mark the index left by imgcache_update() as belonging to a kernel which
+//  booted.  This is called by the kernel, through the functions table.
+void imgcache_confirm(void)
+{
+	size_t len;
+	struct imgcache_pending *p = (struct imgcache_pending *)persist_get(
+			IMGCACHE_PERSIST_TAG, &len);
+	if(!p || (len != sizeof(struct imgcache_pending)))
+		return;
+
+	p->confirmed = 1;
+	persist_commit(p);
+}
@@ -0,0 +1,49 @@
+/* Copyright (C) 2016 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* A cache of boot images on a raw partition
+ *
+ * Loading a file through a filesystem reads directories, FAT chains or
+ * indirect blocks before any data, and the data itself may be fragmented.
+ * The image cache keeps a contiguous copy of each kernel and module loaded
+ * on the last boot in a partition named by the image_cache command, so
+ * each can be read with a single multi-block read.
+ *
+ * New images are written just before the kernel is entered, but the index
+ * only changes to include them once the kernel confirms that it booted (see
+ * imgcache.c), so a kernel which fails never replaces a set which worked.
+ */
+
+#ifndef IMGCACHE_H
+#define IMGCACHE_H
+
+#include <stdint.h>
+#include "imagekey.h"
+
+int imgcache_open(const char *dev_name);
+int imgcache_lookup(const struct image_key *key, uint32_t *length);
+int imgcache_read(int idx, void *dest);
+void imgcache_add(const struct image_key *key, uint32_t addr, uint32_t length);
+void imgcache_update(void);
+void imgcache_confirm(void);
+
+#endif
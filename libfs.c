@@ -211,20 +211,43 @@ size_t fs_fread(uint32_t (*get_next_bdev_block_num)(uint32_t f_block_idx, FILE *
 
 		uint32_t block_segment_length = last_block_offset - start_block_offset;
 
+		// Nothing to read (the request ends on a block boundary)
+		if(block_segment_length == 0)
+			break;
+
 		// Get the filesystem block number
 		uint32_t cur_bdev_block = get_next_bdev_block_num(cur_block, stream, opaque, 0);
 		if(cur_bdev_block == 0xffffffff)
 			return total_bytes_read;
 
+		uint32_t run_blocks = 1;
+
 		// If we can load an entire block, load it directly, else we have
 		//  to load to a buffer somewhere and copy appropriately
 		if((start_block_offset == 0) && (block_segment_length == fs_block_size))
 		{
-			int bytes_read = block_read(fs->parent, save_buf, fs_block_size, cur_bdev_block);
+			// Extend the read over any following whole blocks which are
+			//  contiguous on the device so they are fetched with one
+			//  multi-block read
+			if(fs->parent->supports_multiple_block_read)
+			{
+				uint32_t bdev_blocks_per_block = fs_block_size / fs->parent->block_size;
+				while((cur_block + run_blocks) < last_f_block_idx)
+				{
+					uint32_t next_bdev_block = get_next_bdev_block_num(cur_block + run_blocks,
+						stream, opaque, 0);
+					if(next_bdev_block != cur_bdev_block + run_blocks * bdev_blocks_per_block)
+						break;
+					run_blocks++;
+				}
+			}
+
+			uint32_t run_size = run_blocks * fs_block_size;
+			int bytes_read = block_read(fs->parent, save_buf, run_size, cur_bdev_block);
 			total_bytes_read += bytes_read;
 			stream->pos += bytes_read;
 			save_buf += bytes_read;
-			if((uint32_t)bytes_read != fs_block_size)
+			if((uint32_t)bytes_read != run_size)
 				return total_bytes_read;
 		}
 		else
@@ -253,7 +276,7 @@ size_t fs_fread(uint32_t (*get_next_bdev_block_num)(uint32_t f_block_idx, FILE *
 				return total_bytes_read;
 		}
 
-		cur_block++;
+		cur_block += run_blocks;
 	}
 
 	return total_bytes_read;
@@ -295,22 +318,45 @@ size_t fs_fwrite(uint32_t (*get_next_bdev_block_num)(uint32_t f_block_idx, FILE
 
 		uint32_t block_segment_length = last_block_offset - start_block_offset;
 
+		// Nothing to write (the request ends on a block boundary)
+		if(block_segment_length == 0)
+			break;
+
 		// Get the filesystem block number
 		uint32_t cur_bdev_block = get_next_bdev_block_num(cur_block, stream, opaque, 1);
 		if(cur_bdev_block == 0xffffffff)
 			return total_bytes_written;
 
+		uint32_t run_blocks = 1;
+
 		// If we can save an entire block, save it directly, else we have
 		//  to load to a buffer somewhere, edit, and save
 		if((start_block_offset == 0) && (block_segment_length == fs_block_size))
 		{
-			size_t bytes_written = block_write(fs->parent, save_buf, fs_block_size, cur_bdev_block);
+			// Extend the write over any following whole blocks which are
+			//  contiguous on the device so they go out as one multi-block
+			//  write
+			if(fs->parent->supports_multiple_block_write)
+			{
+				uint32_t bdev_blocks_per_block = fs_block_size / fs->parent->block_size;
+				while((cur_block + run_blocks) < last_f_block_idx)
+				{
+					uint32_t next_bdev_block = get_next_bdev_block_num(cur_block + run_blocks,
+						stream, opaque, 1);
+					if(next_bdev_block != cur_bdev_block + run_blocks * bdev_blocks_per_block)
+						break;
+					run_blocks++;
+				}
+			}
+
+			size_t run_size = run_blocks * fs_block_size;
+			size_t bytes_written = block_write(fs->parent, save_buf, run_size, cur_bdev_block);
 			total_bytes_written += bytes_written;
 			stream->pos += bytes_written;
 			if(stream->pos > stream->len)
 				stream->len = stream->pos;
 			save_buf += bytes_written;
-			if(bytes_written != fs_block_size)
+			if(bytes_written != run_size)
 				return total_bytes_written;
 		}
 		else
@@ -347,8 +393,51 @@ size_t fs_fwrite(uint32_t (*get_next_bdev_block_num)(uint32_t f_block_idx, FILE
 				return total_bytes_written;
 		}
 
-		cur_block++;
+		cur_block += run_blocks;
 	}
 
 	return total_bytes_written;
 }
+
+/* Find where the data at a file offset (which must be a multiple of the
+ * parent's block size) is on the parent device.  *block_num is set to the
+ * device block holding it and *length to the number of bytes, at most
+ * max_length, which follow contiguously on the device.  This lets callers
+ * issue their own (e.g. asynchronous) reads for a file.
+ */
+int fs_fmap(uint32_t (*get_next_bdev_block_num)(uint32_t f_block_idx, FILE *s, void *opaque, int add_blocks),
+	struct fs *fs, FILE *stream, long offset, size_t max_length,
+	uint32_t *block_num, size_t *length, void *opaque)
+{
+	uint32_t fs_block_size = fs->block_size;
+	uint32_t bdev_block_size = fs->parent->block_size;
+
+	if((offset < 0) || (offset >= stream->len) || (offset % bdev_block_size))
+		return -1;
+
+	uint32_t f_block_idx = offset / fs_block_size;
+	uint32_t f_block_offset = offset % fs_block_size;
+	uint32_t bdev_block = get_next_bdev_block_num(f_block_idx, stream, opaque, 0);
+	if(bdev_block == 0xffffffff)
+		return -1;
+
+	// Extend over any following blocks which are contiguous on the device
+	uint32_t bdev_blocks_per_block = fs_block_size / bdev_block_size;
+	size_t len = fs_block_size - f_block_offset;
+	uint32_t run_blocks = 1;
+	while((len < max_length) && (offset + (long)len < stream->len))
+	{
+		uint32_t next_bdev_block = get_next_bdev_block_num(f_block_idx + run_blocks,
+			stream, opaque, 0);
+		if(next_bdev_block != bdev_block + run_blocks * bdev_blocks_per_block)
+			break;
+		run_blocks++;
+		len += fs_block_size;
+	}
+	if(len > max_length)
+		len = max_length;
+
+	*block_num = bdev_block + f_block_offset / bdev_block_size;
+	*length = len;
+	return 0;
+}
@@ -0,0 +1,476 @@
+/* Copyright (C) 2016 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libfdt.h>
+#include "atag.h"
+#include "output.h"
+#include "linux.h"
+#include "memchunk.h"
+
+/* Memory layout (offsets from the start of RAM)
+ *
+ * The zImage decompressor writes the kernel to RAM + TEXT_OFFSET.  If the
+ * zImage itself lies in the way it first copies itself out of the way, so
+ * we load it far enough up that this isn't necessary (Documentation/arm/
+ * booting recommends above 32 MiB).  The initrd and device tree go above
+ * 128 MiB so they are not overwritten while the kernel is decompressed.
+ */
+#define LINUX_TEXT_OFFSET		0x8000
+#define LINUX_KERNEL_OFFSET		0x2000000
+#define LINUX_DATA_OFFSET		0x8000000
+
+// Worst case size of the decompressed kernel relative to the zImage
+#define LINUX_ZIMAGE_RATIO		4
+
+// Space after the zImage for the decompressor's bss, stack and heap
+#define LINUX_ZIMAGE_SLACK		0x20000
+
+// Space added to the device tree for the properties we set in /chosen
+#define LINUX_DTB_SLACK			0x1000
+
+// ATAGs must be in the first 16 kiB of RAM
+#define LINUX_ATAG_OFFSET		0x100
+#define LINUX_ATAG_MAX			(0x4000 - LINUX_ATAG_OFFSET)
+
+#define ZIMAGE_MAGIC			0x016F2818
+#define ARM64_IMAGE_MAGIC		0x644d5241
+
+#define tag_next(t)		(struct atag *)((uint32_t *)(t) + (t)->hdr.size)
+
+extern uintptr_t _atags;
+extern unsigned long _arm_m_type;
+extern int conf_source;
+
+static int kernel_loaded = 0;
+static char *kernel_cmdline = NULL;
+static uint32_t initrd_start = 0;
+static uint32_t initrd_end = 0;
+static void *user_dtb = NULL;
+
+static uint32_t ram_base = 0xffffffff;
+static uint32_t data_next = 0;
+
+static void ram_base_cb(uint32_t addr, uint32_t len)
+{
+	(void)len;
+	if(addr < ram_base)
+		ram_base = addr;
+}
+
+static uint32_t get_ram_base(void)
+{
+	if(ram_base == 0xffffffff)
+	{
+		parse_atag_or_dtb(ram_base_cb);
+		if(ram_base == 0xffffffff)
+			ram_base = 0;
+	}
+	return ram_base;
+}
+
+// Allocate memory for the initrd or device tree, preferably just above
+//  128 MiB where the kernel won't overwrite it during decompression
+static uint32_t linux_alloc_data(uint32_t length, uint32_t align, const char *name)
+{
+	uint32_t base = get_ram_base() + LINUX_DATA_OFFSET;
+	if(data_next < base)
+		data_next = base;
+
+	uint32_t addr = (data_next + align - 1) & ~(align - 1);
+	if(chunk_get_chunk(addr, length))
+	{
+		data_next = addr + length;
+		return addr;
+	}
+
+	addr = chunk_get_aligned_chunk(length, align, CHUNK_BEST_FIT);
+	if(addr && (addr < base))
+		printf("LINUX: warning: %s placed at 0x%08x, below the 128 MiB "
+				"boundary\n", name, addr);
+	return addr;
+}
+
+static int load_file(FILE *fp, uint32_t addr, uint32_t length, const char *name)
+{
+	fseek(fp, 0, SEEK_SET);
+	size_t bytes_read = fread((void *)(uintptr_t)addr, 1, (size_t)length, fp);
+	if(bytes_read != (size_t)length)
+	{
+		printf("LINUX: error loading %s only %i out of %i bytes read\n",
+				name, bytes_read, length);
+		return -1;
+	}
+	return 0;
+}
+
+#ifndef __aarch64__
+static int load_zimage(FILE *fp, const uint32_t *hdr, const char *name, uintptr_t *entry)
+{
+	uint32_t length = (uint32_t)fp->len;
+
+	// The header gives the start and end of the zImage proper, the file may
+	//  have a device tree appended
+	uint32_t zsize = hdr[0x2c / 4] - hdr[0x28 / 4];
+	if((zsize == 0) || (zsize > length))
+		zsize = length;
+
+	uint32_t offset = LINUX_KERNEL_OFFSET;
+	uint32_t needed = LINUX_TEXT_OFFSET + zsize * LINUX_ZIMAGE_RATIO;
+	if(needed > offset)
+		offset = (needed + 0x1fffff) & ~0x1fffff;
+
+	uint32_t addr = get_ram_base() + offset;
+	uint32_t reserve = length + LINUX_ZIMAGE_SLACK;
+	if(!chunk_get_chunk(addr, reserve))
+	{
+		addr = chunk_get_aligned_chunk(reserve, 0x1000, CHUNK_BEST_FIT);
+		if(!addr)
+		{
+			printf("LINUX: unable to allocate %i bytes for %s\n",
+					reserve, name);
+			return -1;
+		}
+		printf("LINUX: %s loaded at 0x%08x, the kernel will need to "
+				"relocate itself\n", name, addr);
+	}
+
+	if(load_file(fp, addr, length, name) != 0)
+		return -1;
+
+	*entry = addr;
+	return 0;
+}
+#else
+static int load_arm64_image(FILE *fp, const uint32_t *hdr, const char *name, uintptr_t *entry)
+{
+	uint32_t length = (uint32_t)fp->len;
+
+	// The kernel must be text_offset bytes above a 2 MiB aligned address
+	uint64_t text_offset = (uint64_t)hdr[0x08 / 4] | ((uint64_t)hdr[0x0c / 4] << 32);
+	uint64_t image_size = (uint64_t)hdr[0x10 / 4] | ((uint64_t)hdr[0x14 / 4] << 32);
+	if(image_size == 0)
+	{
+		// Kernels before 3.17 don't give their size
+		text_offset = 0x80000;
+		image_size = length;
+	}
+	if(image_size < length)
+		image_size = length;
+
+	uint32_t addr = get_ram_base() + LINUX_KERNEL_OFFSET + (uint32_t)text_offset;
+	if(!chunk_get_chunk(addr, (uint32_t)image_size))
+	{
+		addr = chunk_get_aligned_chunk((uint32_t)(text_offset + image_size),
+				0x200000, CHUNK_BEST_FIT);
+		if(!addr)
+		{
+			printf("LINUX: unable to allocate %i bytes for %s\n",
+					(uint32_t)image_size, name);
+			return -1;
+		}
+		addr += (uint32_t)text_offset;
+	}
+
+	if(load_file(fp, addr, length, name) != 0)
+		return -1;
+
+	*entry = addr;
+	return 0;
+}
+#endif
+
+int linux_load_kernel(FILE *fp, const char *name, char *cmdline, uintptr_t *entry)
+{
+	uint32_t hdr[0x40 / 4];
+
+	fseek(fp, 0, SEEK_SET);
+	size_t hdr_len = fread(hdr, 1, sizeof(hdr), fp);
+
+	int retno;
+	if((hdr_len >= 0x30) && (hdr[0x24 / 4] == ZIMAGE_MAGIC))
+	{
+#ifndef __aarch64__
+		retno = load_zimage(fp, hdr, name, entry);
+#else
+		printf("LINUX: %s is a 32-bit kernel, which cannot be booted "
+				"from AArch64\n", name);
+		return -1;
+#endif
+	}
+	else if((hdr_len >= 0x40) && (hdr[0x38 / 4] == ARM64_IMAGE_MAGIC))
+	{
+#ifdef __aarch64__
+		retno = load_arm64_image(fp, hdr, name, entry);
+#else
+		printf("LINUX: %s is a 64-bit kernel, which cannot be booted "
+				"from AArch32\n", name);
+		return -1;
+#endif
+	}
+	else
+	{
+		printf("LINUX: %s is not a Linux kernel image\n", name);
+		return -1;
+	}
+
+	if(retno != 0)
+		return retno;
+
+	kernel_loaded = 1;
+	kernel_cmdline = cmdline;
+	printf("LINUX: loaded kernel %s at 0x%08x\n", name, *entry);
+	return 0;
+}
+
+int linux_load_initrd(FILE *fp, const char *name)
+{
+	// The initrd is passed to the kernel as it is in the file, the kernel
+	//  decompresses it itself
+	uint32_t length = (uint32_t)fp->len;
+	uint32_t addr = linux_alloc_data(length, 0x1000, name);
+	if(!addr)
+	{
+		printf("INITRD: unable to allocate a chunk of size %i for %s\n",
+				length, name);
+		return -1;
+	}
+
+	if(load_file(fp, addr, length, name) != 0)
+		return -1;
+
+	initrd_start = addr;
+	initrd_end = addr + length;
+	printf("INITRD: %s loaded at 0x%08x\n", name, addr);
+	return 0;
+}
+
+int linux_load_dtb(FILE *fp, const char *name)
+{
+	uint32_t length = (uint32_t)fp->len;
+	void *dtb = malloc(length);
+	if(!dtb)
+	{
+		printf("DTB: unable to allocate %i bytes for %s\n", length, name);
+		return -1;
+	}
+
+	size_t bytes_read = fread(dtb, 1, (size_t)length, fp);
+	if((bytes_read != (size_t)length) || (fdt_check_header(dtb) != 0) ||
+			(fdt_totalsize(dtb) > length))
+	{
+		printf("DTB: %s is not a valid device tree\n", name);
+		free(dtb);
+		return -1;
+	}
+
+	if(user_dtb)
+		free(user_dtb);
+	user_dtb = dtb;
+	printf("DTB: %s loaded\n", name);
+	return 0;
+}
+
+int linux_is_loaded(void)
+{
+	return kernel_loaded;
+}
+
+static int set_chosen(void *dtb)
+{
+	int chosen = fdt_path_offset(dtb, "/chosen");
+	if(chosen == -FDT_ERR_NOTFOUND)
+		chosen = fdt_add_subnode(dtb, 0, "chosen");
+	if(chosen < 0)
+		return chosen;
+
+	int ret;
+	if(kernel_cmdline && *kernel_cmdline)
+	{
+		ret = fdt_setprop_string(dtb, chosen, "bootargs", kernel_cmdline);
+		if(ret != 0)
+			return ret;
+	}
+
+	if(initrd_end > initrd_start)
+	{
+		// Use the same cell size as the rest of the tree
+		if(fdt_address_cells(dtb, 0) == 2)
+		{
+			ret = fdt_setprop_u64(dtb, chosen, "linux,initrd-start", initrd_start);
+			if(ret == 0)
+				ret = fdt_setprop_u64(dtb, chosen, "linux,initrd-end", initrd_end);
+		}
+		else
+		{
+			ret = fdt_setprop_u32(dtb, chosen, "linux,initrd-start", initrd_start);
+			if(ret == 0)
+				ret = fdt_setprop_u32(dtb, chosen, "linux,initrd-end", initrd_end);
+		}
+		if(ret != 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+// Copy the device tree (from the dtb command or the firmware) somewhere safe
+//  with space to add the command line and initrd to /chosen
+static uintptr_t build_dtb(void)
+{
+	const void *src = user_dtb;
+	if(!src && (conf_source == 3))
+		src = (const void *)_atags;
+	else if(!src && (conf_source == 4))
+		src = (const void *)0;
+	else if(!src)
+		return 0;
+
+	uint32_t size = fdt_totalsize(src) + LINUX_DTB_SLACK;
+	if(kernel_cmdline)
+		size += strlen(kernel_cmdline);
+
+	uint32_t addr = linux_alloc_data(size, 8, "device tree");
+	if(!addr)
+	{
+		printf("LINUX: unable to allocate %i bytes for the device tree\n",
+				size);
+		return 0;
+	}
+
+	void *dtb = (void *)(uintptr_t)addr;
+	int ret = fdt_open_into(src, dtb, (int)size);
+	if(ret == 0)
+		ret = set_chosen(dtb);
+	if(ret == 0)
+		ret = fdt_pack(dtb);
+	if(ret != 0)
+	{
+		printf("LINUX: unable to update the device tree: %s\n",
+				fdt_strerror(ret));
+		return 0;
+	}
+
+	return addr;
+}
+
+#ifndef __aarch64__
+static uint32_t *add_tag(uint32_t *p, uint32_t *end, uint32_t tag, const void *data, uint32_t len)
+{
+	uint32_t words = 2 + (len + 3) / 4;
+	if(!p || (p + words > end))
+		return NULL;
+
+	struct atag *t = (struct atag *)p;
+	t->hdr.size = words;
+	t->hdr.tag = tag;
+	memset(&t->u, 0, (words - 2) * 4);
+	memcpy(&t->u, data, len);
+	return p + words;
+}
+
+// Rebuild the ATAG list with our command line and initrd in place of those
+//  from the firmware
+static uintptr_t build_atags(void)
+{
+	const struct atag *cur;
+	if(conf_source == 1)
+		cur = (const struct atag *)_atags;
+	else if(conf_source == 2)
+		cur = (const struct atag *)0;
+	else
+		return 0;
+
+	int new_cmdline = kernel_cmdline && *kernel_cmdline;
+	int new_initrd = initrd_end > initrd_start;
+
+	uint32_t *buf = (uint32_t *)malloc(LINUX_ATAG_MAX);
+	uint32_t *end = buf + LINUX_ATAG_MAX / 4;
+	uint32_t *p = buf;
+
+	while(p && (cur->hdr.tag != ATAG_NONE) && (cur->hdr.size >= 2))
+	{
+		if(!((cur->hdr.tag == ATAG_CMDLINE) && new_cmdline) &&
+				!((cur->hdr.tag == ATAG_INITRD2) && new_initrd))
+			p = add_tag(p, end, cur->hdr.tag, &cur->u, (cur->hdr.size - 2) * 4);
+		cur = tag_next(cur);
+	}
+
+	if(new_cmdline)
+		p = add_tag(p, end, ATAG_CMDLINE, kernel_cmdline,
+				strlen(kernel_cmdline) + 1);
+	if(new_initrd)
+	{
+		struct atag_initrd2 initrd;
+		initrd.start = initrd_start;
+		initrd.size = initrd_end - initrd_start;
+		p = add_tag(p, end, ATAG_INITRD2, &initrd, sizeof(initrd));
+	}
+	p = add_tag(p, end, ATAG_NONE, NULL, 0);
+	if(!p)
+	{
+		printf("LINUX: ATAG list too long\n");
+		free(buf);
+		return 0;
+	}
+	// ATAG_NONE has a size of zero
+	((struct atag *)(p - 2))->hdr.size = 0;
+
+	uintptr_t addr = get_ram_base() + LINUX_ATAG_OFFSET;
+	memcpy((void *)addr, buf, (p - buf) * 4);
+	free(buf);
+	return addr;
+}
+#endif
+
+int linux_boot(uintptr_t entry)
+{
+	uintptr_t params = build_dtb();
+#ifndef __aarch64__
+	if(!params && !user_dtb && ((conf_source == 1) || (conf_source == 2)))
+		params = build_atags();
+#endif
+	if(!params)
+	{
+		printf("BOOT: no device tree or ATAGs to pass to the kernel\n");
+		return -1;
+	}
+
+	printf("BOOT: Linux load\n");
+	output_handover();
+
+#ifdef __aarch64__
+	// x0 = device tree, x1-x3 = 0
+	void (*e_point)(uintptr_t, uintptr_t, uintptr_t, uintptr_t) =
+		(void(*)(uintptr_t, uintptr_t, uintptr_t, uintptr_t))entry;
+	e_point(params, 0, 0, 0);
+#else
+	// r0 = 0, r1 = machine type, r2 = device tree or ATAGs
+	void (*e_point)(uint32_t, uint32_t, uint32_t) =
+		(void(*)(uint32_t, uint32_t, uint32_t))entry;
+	e_point(0, _arm_m_type, params);
+#endif
+	return 0;
+}
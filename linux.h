@@ -0,0 +1,42 @@
+/* Copyright (C) 2016 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Native Linux boot support
+ *
+ * Loads an ARM zImage (or an arm64 Image when built for aarch64), an
+ * optional initrd and device tree, and jumps to the kernel using the
+ * Linux ARM boot protocol.
+ */
+
+#ifndef LINUX_H
+#define LINUX_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+int linux_load_kernel(FILE *fp, const char *name, char *cmdline, uintptr_t *entry);
+int linux_load_initrd(FILE *fp, const char *name);
+int linux_load_dtb(FILE *fp, const char *name);
+int linux_is_loaded(void);
+int linux_boot(uintptr_t entry);
+
+#endif
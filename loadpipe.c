@@ -0,0 +1,302 @@
+/* Copyright (C) 2016 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vfs.h"
+#include "fs.h"
+#include "block.h"
+#include "timer.h"
+#include "util.h"
+#include "loadpipe.h"
+#ifdef ENABLE_BOOT_TIMELINE
+#endif
+
+// Number and size of the read-ahead buffers
+#define LOAD_PIPE_BUFFERS		3
+#define LOAD_PIPE_CHUNK			65536
+
+struct pipe_buf
+{
+	struct block_request req;
+	uint8_t *data;
+	long offset;				// file offset of data[0]
+	size_t len;					// bytes of file data in the buffer
+	int busy;
+};
+
+struct load_pipe
+{
+	struct fs fs;
+	FILE *src;
+	struct block_device *dev;
+
+	struct pipe_buf bufs[LOAD_PIPE_BUFFERS];
+	int head;					// buffer currently being consumed
+	int tail;					// next buffer to submit
+	size_t head_pos;			// bytes consumed from the head buffer
+	long next_offset;			// file offset of the next chunk to submit
+	int error;
+};
+
+struct load_stats load_stats;
+
+void load_stats_start(void)
+{
+	memset(&load_stats, 0, sizeof(struct load_stats));
+	load_stats.start_us = timer_get_us();
+}
+
+void load_stats_print(const char *name, size_t bytes_loaded)
+{
+	uint32_t total_us = timer_get_us() - load_stats.start_us;
+	uint32_t other_us = total_us - load_stats.io_wait_us - load_stats.copy_us -
+		load_stats.decompress_us - load_stats.crc_us;
+
+	printf("LOAD: %s: %i bytes in %i us (%i bytes read)\n", name, bytes_loaded,
+			total_us, load_stats.bytes_read);
+	printf("LOAD:  io wait %i us, copy %i us, decompress %i us, crc %i us, "
+			"other %i us\n", load_stats.io_wait_us, load_stats.copy_us,
+			load_stats.decompress_us, load_stats.crc_us, other_us);
+}
+
+// Queue reads for the following chunks of the file into any free buffers
+static void pipe_fill(struct load_pipe *p)
+{
+	size_t dev_block_size = p->dev->block_size;
+
+	while(!p->bufs[p->tail].busy && (p->next_offset < p->src->len))
+	{
+		struct pipe_buf *b = &p->bufs[p->tail];
+		uint32_t block_num;
+		size_t len;
+
+		if(p->src->fs->fmap(p->src, p->next_offset, LOAD_PIPE_CHUNK,
+				&block_num, &len) != 0)
+		{
+			p->error = 1;
+			break;
+		}
+
+		b->offset = p->next_offset;
+		b->len = len;
+		if(b->offset + (long)b->len > p->src->len)
+			b->len = (size_t)(p->src->len - b->offset);
+
+		memset(&b->req, 0, sizeof(struct block_request));
+		b->req.buf = b->data;
+		b->req.buf_size = (b->len + dev_block_size - 1) / dev_block_size *
+			dev_block_size;
+		b->req.block_num = block_num;
+		b->busy = 1;
+
+		if(block_submit(p->dev, &b->req) != 0)
+		{
+			b->busy = 0;
+			p->error = 1;
+			break;
+		}
+
+		load_stats.io_count++;
+		p->next_offset += (long)len;
+		p->tail = (p->tail + 1) % LOAD_PIPE_BUFFERS;
+	}
+
+	// Get the requests moving
+	block_poll(p->dev);
+}
+
+// Wait for everything outstanding and start again from offset
+static void pipe_reset(struct load_pipe *p, long offset)
+{
+	for(int i = 0; i < LOAD_PIPE_BUFFERS; i++)
+	{
+		if(p->bufs[i].busy)
+			block_wait(p->dev, &p->bufs[i].req);
+		p->bufs[i].busy = 0;
+	}
+
+	long aligned = offset - offset % (long)p->dev->block_size;
+	p->head = 0;
+	p->tail = 0;
+	p->next_offset = aligned;
+	p->head_pos = (size_t)(offset - aligned);
+	p->error = 0;
+}
+
+static size_t pipe_fread(struct fs *fs, void *ptr, size_t byte_size, FILE *stream)
+{
+	struct load_pipe *p = (struct load_pipe *)stream->opaque;
+	uint8_t *dest = (uint8_t *)ptr;
+	size_t total = 0;
+	(void)fs;
+
+	while(total < byte_size)
+	{
+		pipe_fill(p);
+
+		struct pipe_buf *b = &p->bufs[p->head];
+		if(!b->busy)
+			break;
+
+		uint32_t t0 = timer_get_us();
+		int result = block_wait(p->dev, &b->req);
+		uint32_t t1 = timer_get_us();
+		load_stats.io_wait_us += t1 - t0;
+
+		if((result < 0) || ((size_t)result < b->len))
+		{
+			printf("LOAD: error reading at offset %i\n", b->offset);
+			p->error = 1;
+			break;
+		}
+		if(p->head_pos == 0)
+			load_stats.bytes_read += (uint32_t)result;
+
+		size_t to_copy = b->len - p->head_pos;
+		if(to_copy > byte_size - total)
+			to_copy = byte_size - total;
+		memcpy(&dest[total], &b->data[p->head_pos], to_copy);
+		load_stats.copy_us += timer_get_us() - t1;
+
+		total += to_copy;
+		p->head_pos += to_copy;
+		if(p->head_pos == b->len)
+		{
+			// Done with this buffer, it can be reused for read-ahead
+			b->busy = 0;
+			p->head = (p->head + 1) % LOAD_PIPE_BUFFERS;
+			p->head_pos = 0;
+		}
+	}
+
+	if(p->error)
+		stream->flags |= VFS_FLAGS_ERROR;
+	stream->pos += (long)total;
+	return total;
+}
+
+static int pipe_fseek(FILE *stream, long offset, int whence)
+{
+	struct load_pipe *p = (struct load_pipe *)stream->opaque;
+	long target;
+
+	switch(whence)
+	{
+		case SEEK_SET:
+			target = offset;
+			break;
+		case SEEK_END:
+			target = stream->len - offset;
+			break;
+		case SEEK_CUR:
+			target = stream->pos + offset;
+			break;
+		default:
+			return -1;
+	}
+	if(target < 0)
+		target = 0;
+	if(target > stream->len)
+		target = stream->len;
+
+	// Skip forwards within the current buffer if we can, else start again
+	struct pipe_buf *b = &p->bufs[p->head];
+	if(b->busy && (target >= stream->pos) && (target < b->offset + (long)b->len))
+		p->head_pos = (size_t)(target - b->offset);
+	else
+		pipe_reset(p, target);
+
+	stream->pos = target;
+	return 0;
+}
+
+static int pipe_fclose(struct fs *fs, FILE *fp)
+{
+	struct load_pipe *p = (struct load_pipe *)fp->opaque;
+	(void)fs;
+
+	pipe_reset(p, 0);
+	for(int i = 0; i < LOAD_PIPE_BUFFERS; i++)
+		free(p->bufs[i].data);
+	fclose(p->src);
+	free(p);
+	fp->opaque = NULL;
+	return 0;
+}
+
+/* Returns a FILE which reads src through the read-ahead buffers, and closes
+ * src along with it.  If src's filesystem can't tell us where its data is
+ * then src is returned unchanged.
+ */
+FILE *pipe_fopen(FILE *src)
+{
+	if(!src->fs->fmap || !src->fs->parent || (src->len == 0))
+		return src;
+
+	struct load_pipe *p = (struct load_pipe *)malloc(sizeof(struct load_pipe));
+	if(p == NULL)
+		return src;
+	memset(p, 0, sizeof(struct load_pipe));
+
+	for(int i = 0; i < LOAD_PIPE_BUFFERS; i++)
+	{
+		p->bufs[i].data = (uint8_t *)malloc(LOAD_PIPE_CHUNK);
+		if(p->bufs[i].data == NULL)
+		{
+			for(int j = 0; j < i; j++)
+				free(p->bufs[j].data);
+			free(p);
+			return src;
+		}
+	}
+
+	p->src = src;
+	p->dev = src->fs->parent;
+	p->fs.parent = src->fs->parent;
+	p->fs.fs_name = "loadpipe";
+	p->fs.block_size = LOAD_PIPE_CHUNK;
+	p->fs.fread = pipe_fread;
+	p->fs.fseek = pipe_fseek;
+	p->fs.fclose = pipe_fclose;
+
+	FILE *ret = (FILE *)malloc(sizeof(struct vfs_file));
+	if(ret == NULL)
+	{
+		for(int i = 0; i < LOAD_PIPE_BUFFERS; i++)
+			free(p->bufs[i].data);
+		free(p);
+		return src;
+	}
+	memset(ret, 0, sizeof(struct vfs_file));
+	ret->fs = &p->fs;
+	ret->pos = 0;
+	ret->mode = VFS_MODE_R;
+	ret->opaque = p;
+	ret->len = src->len;
+
+	// Start reading straight away
+	pipe_fill(p);
+	return ret;
+}
@@ -0,0 +1,56 @@
+/* Copyright (C) 2016 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* A read-ahead stage for loading files
+ *
+ * pipe_fopen() wraps a file in a FILE which keeps several chunks of it
+ * being read from the block device asynchronously, so the next chunk is
+ * arriving while the caller decompresses, checks or copies the current
+ * one.  load_stats accumulates the time spent in each stage of a load.
+ */
+
+#ifndef LOADPIPE_H
+#define LOADPIPE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+struct load_stats
+{
+	uint32_t start_us;
+	uint32_t io_wait_us;		// waiting for the block device
+	uint32_t copy_us;			// copying from the read-ahead buffers
+	uint32_t decompress_us;
+	uint32_t crc_us;
+	uint32_t bytes_read;		// from the block device
+	uint32_t io_count;			// requests submitted to the block device
+};
+
+extern struct load_stats load_stats;
+
+FILE *pipe_fopen(FILE *src);
+void load_stats_start(void);
+void load_stats_print(const char *name, size_t bytes_loaded);
+
+#endif
+
@@ -21,88 +21,275 @@
 
 /* Based on an idea by https://github.com/JamesC1 */
 
-/* Support for writing the console log to a file.
+/* Boot log.
  *
- * The main problem here is that some devices (e.g. SD cards) have limited
- * write cycles, so writing every character to them is problematic.  Thus, we
- * buffer writes to try and do, e.g. one block at a time.  The problem here is
- * that if the guest OS crashes at some point, the buffer may not be flushed to
- * disk.  We try and ameliorate this by 1) providing the guest OS with a
- * fflush() function to flush at important moments, and 2) automatically
- * flushing if log_putc is called and it has been more than a certain time
- * since the last flush.
+ * Everything sent to the 'log' output is kept in a fixed size ring of
+ * records in memory, one per line, each with the time the line was started,
+ * a level (output to stderr is logged as an error) and the subsystem named by
+ * the "NAME: " prefix most messages start with.  Once the ring is full the
+ * oldest records are overwritten.  The format is defined in multiboot.h, and
+ * the ring is handed to the kernel at boot.
  *
- * This can still miss certain log outputs, but is probably the best
- * compromise.  The ideal situation would be to have a background thread
- * periodically flushing the buffer to disk, but as we are only a bootloader,
- * we cannot hijack the timer interrupt that the guest OS would probably want
- * to use itself.
+ * If a log file is registered the records are also written to it.  Some
+ * devices (e.g. SD cards) have limited write cycles, so rather than writing
+ * every line we wait until at least buffer_size bytes of records are pending
+ * and write them in one go, ending on a multiple of buffer_size in the file.
+ * The rest is written by fflush() on the log file, which the guest OS can
+ * call at important moments, and just before the kernel is started.  If
+ * the guest OS crashes before then, whatever had not been written is still
+ * in the ring it was given.
+ *
+ * As we are only a bootloader we cannot hijack the timer interrupt for a
+ * background flush, and writing from the timer idle hook would re-enter the
+ * block device drivers, so writes are only started from log_write itself.
  */
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include "timer.h"
 #include "vfs.h"
 #include "output.h"
+#include "memchunk.h"
+#include "multiboot.h"
+#include "log.h"
 
-FILE *log_fp = NULL;
-uint8_t *log_buf = NULL;
-size_t buf_size;
-size_t buf_ptr;
-struct timer_wait last_update;
+// Longer lines are split into several records
+#define LOG_LINE_MAX			248
 
-// Time between flushes (requires that log_putc is actually called at some point)
-#define LOG_TIMEOUT			5000000
+// Longest "NAME: " prefix taken as the subsystem
+#define LOG_SUBSYS_MAX			16
 
-int log_putc(int c)
+#if ((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) != 0) || (LOG_RING_SIZE > 0x10000)
+#error LOG_RING_SIZE must be a power of two, at most 64 kiB
+#endif
+
+// Left in .bss so as not to add the ring to the image, see log_init()
+static uint32_t ring_mem[(sizeof(struct boot_log) + LOG_RING_SIZE) / 4]
+	__attribute__((aligned(8)));
+static struct boot_log *const ring = (struct boot_log *)ring_mem;
+
+// The line being assembled
+static char line[LOG_LINE_MAX];
+static size_t line_len = 0;
+static uint32_t line_start;
+static int line_level;
+static int line_cont = 0;		// the previous record was BOOT_LOG_CONTINUED
+
+static FILE *log_fp = NULL;
+static size_t flush_size = 0;
+static uint32_t flushed = 0;	// ring offset written to the log file up to
+static uint32_t file_pos = 0;
+
+static inline struct boot_log_record *record_at(uint32_t offset)
 {
-	if(last_update.trigger_value == 0)
-		last_update = register_timer(LOG_TIMEOUT);
+	return (struct boot_log_record *)&ring->data[offset & (ring->size - 1)];
+}
+
+// Write records up to 'end' to the log file
+static void write_out(uint32_t end)
+{
+	// Disable output to the log for the write
+	rpi_boot_output_state state = output_get_state();
+	output_disable_log();
 
-	if(log_buf && buf_size)
+	while(flushed != end)
 	{
-		log_buf[buf_ptr++] = c;
-		if(buf_ptr >= buf_size)
-		{
-			if(log_fp && log_fp->fflush_cb)
-			{
-				log_fp->fflush_cb(log_fp);
-				last_update = register_timer(LOG_TIMEOUT);
-			}
-			buf_ptr = 0;
-		}
-		return 0;
+		uint32_t offset = flushed & (ring->size - 1);
+		uint32_t len = end - flushed;
+		if(len > ring->size - offset)
+			len = ring->size - offset;
+
+		fwrite(&ring->data[offset], 1, len, log_fp);
+		flushed += len;
+		file_pos += len;
+	}
+
+	// Restore saved output state
+	output_restore_state(state);
+}
+
+static void drop_oldest(void)
+{
+	struct boot_log_record *r = record_at(ring->tail);
+	uint32_t next = ring->tail + BOOT_LOG_RECORD_LENGTH(r->text_len);
+
+	if((int32_t)(flushed - ring->tail) <= 0)
+	{
+		// Never reached the log file
+		if(r->level != BOOT_LOG_PAD)
+			ring->dropped++;
+		flushed = next;
+	}
+	else if(log_fp && ((int32_t)(flushed - next) < 0))
+	{
+		// Finish a record part written by the last lazy flush, so that the
+		//  file stays a sequence of whole records
+		write_out(next);
 	}
-	else if(log_fp)
+	ring->tail = next;
+}
+
+static void *reserve(uint32_t len)
+{
+	while(ring->head + len - ring->tail > ring->size)
+		drop_oldest();
+
+	void *ret = record_at(ring->head);
+	ring->head += len;
+	return ret;
+}
+
+static void append_record(uint32_t timestamp, int level, const char *subsys,
+		size_t subsys_len, const char *msg, size_t msg_len)
+{
+	size_t text_len = subsys_len + msg_len;
+	uint32_t len = BOOT_LOG_RECORD_LENGTH(text_len);
+
+	// Records do not wrap: fill the end of the ring instead
+	uint32_t offset = ring->head & (ring->size - 1);
+	if(offset + len > ring->size)
 	{
-		// Disable output to the log for the write
-		rpi_boot_output_state state = output_get_state();
-		output_disable_log();
+		struct boot_log_record *pad = reserve(ring->size - offset);
+		pad->timestamp_us = timestamp;
+		pad->text_len = ring->size - offset - sizeof(struct boot_log_record);
+		pad->level = BOOT_LOG_PAD;
+		pad->subsys_len = 0;
+	}
 
-		// Write one character
-		fwrite(&c, 1, 1, log_fp);
+	struct boot_log_record *r = reserve(len);
+	r->timestamp_us = timestamp;
+	r->text_len = (uint16_t)text_len;
+	r->level = (uint8_t)level;
+	r->subsys_len = (uint8_t)subsys_len;
+	memcpy(r->text, subsys, subsys_len);
+	memcpy(&r->text[subsys_len], msg, msg_len);
+	memset(&r->text[text_len], 0, len - sizeof(struct boot_log_record) - text_len);
+}
 
-		// Restore saved output state
-		output_restore_state(state);
+// Length of a "NAME: " prefix at the start of the line, not counting the ':'
+static size_t subsys_length(const char *s, size_t len)
+{
+	size_t i = 0;
+	while((i < len) && (i < LOG_SUBSYS_MAX) &&
+			(((s[i] >= 'A') && (s[i] <= 'Z')) || ((s[i] >= '0') && (s[i] <= '9')) ||
+			(s[i] == '_') || (s[i] == '-')))
+		i++;
+	if((i == 0) || (i >= len) || (s[i] != ':'))
 		return 0;
+	return i;
+}
+
+static void commit_line(int flags)
+{
+	size_t subsys_len = 0;
+	size_t msg_start = 0;
+	if(!line_cont)
+	{
+		subsys_len = subsys_length(line, line_len);
+		if(subsys_len)
+		{
+			msg_start = subsys_len + 1;
+			if((msg_start < line_len) && (line[msg_start] == ' '))
+				msg_start++;
+		}
 	}
-	return EOF;
+
+	append_record(line_start, line_level | flags, line, subsys_len,
+			&line[msg_start], line_len - msg_start);
+	line_cont = flags & BOOT_LOG_CONTINUED;
+	line_len = 0;
 }
 
-static int log_fflush(FILE *fp)
+// Start a write to the log file once flush_size bytes are waiting
+static void lazy_flush(void)
+{
+	if(!log_fp)
+		return;
+
+	uint32_t waiting = ring->head - flushed;
+	if((waiting == 0) || (waiting < flush_size))
+		return;
+
+	uint32_t end = ring->head;
+	if(flush_size)
+		end -= (file_pos + waiting) % flush_size;
+	write_out(end);
+}
+
+int log_write_level(const char *buf, size_t len, int level)
 {
-	// Flush the buffer
-	if(fp && log_buf)
+	if(line_len && (level != line_level))
+		commit_line(BOOT_LOG_CONTINUED);
+
+	while(len)
 	{
-		// Disable output to the log for the write
-		rpi_boot_output_state state = output_get_state();
-		output_disable_log();
+		if(line_len == 0)
+		{
+			line_start = timer_get_us();
+			line_level = level;
+		}
+
+		const char *nl = memchr(buf, '\n', len);
+		size_t to_copy = nl ? (size_t)(nl - buf) : len;
+		int full = 0;
+		if(to_copy >= LOG_LINE_MAX - line_len)
+		{
+			to_copy = LOG_LINE_MAX - line_len;
+			full = 1;
+		}
+
+		memcpy(&line[line_len], buf, to_copy);
+		line_len += to_copy;
+		buf += to_copy;
+		len -= to_copy;
+
+		if(full)
+			commit_line(BOOT_LOG_CONTINUED);
+		else if(nl)
+		{
+			commit_line(0);
+			buf++;
+			len--;
+		}
+	}
+
+	lazy_flush();
+	return 0;
+}
 
-		// Write the buffer
-		fwrite(log_buf, 1, buf_ptr, fp);
+// Set up the ring header, before anything is logged
+void log_init(void)
+{
+	ring->magic = BOOT_LOG_MAGIC;
+	ring->version = BOOT_LOG_VERSION;
+	ring->size = LOG_RING_SIZE;
+}
+
+int log_write(const char *buf, size_t len)
+{
+	return log_write_level(buf, len, BOOT_LOG_INFO);
+}
+
+int log_putc(int c)
+{
+	char ch = (char)c;
+	return log_write(&ch, 1);
+}
+
+// Move any partial line into the ring
+static void log_sync(void)
+{
+	if(line_len)
+		commit_line(BOOT_LOG_CONTINUED);
+}
 
-		// Restore the state
-		output_restore_state(state);
+static int log_fflush(FILE *fp)
+{
+	if(fp && (fp == log_fp))
+	{
+		log_sync();
+		write_out(ring->head);
 	}
 	return 0;
 }
@@ -110,56 +297,36 @@ static int log_fflush(FILE *fp)
 int register_log_file(FILE *fp, size_t buffer_size)
 {
 	// If we have a current log, flush it
+	int had_log = 0;
 	if(log_fp)
 	{
 		fflush(log_fp);
 
 		// deregister fflush callback
 		log_fp->fflush_cb = NULL;
+		had_log = 1;
 	}
 
+	log_fp = fp;
+	flush_size = buffer_size;
+	if(flush_size > ring->size / 2)
+		flush_size = ring->size / 2;
+
 	// If passed NULL, then set no log file
 	if(fp == NULL)
-	{
-		if(log_buf)
-			free(log_buf);
-
-		// We can still use a buffer without a file, for flushing
-		//  later to the file
-		if(buffer_size)
-			log_buf = (uint8_t *)malloc(buffer_size);
-		else
-			log_buf = NULL;
-		buf_size = buffer_size;
-		buf_ptr = 0;
-		log_fp = NULL;
 		return 0;
-	}
-	
+
 	// Store the fflush callback
 	fp->fflush_cb = log_fflush;
 
-	// If no current log, and there is a buffer, then flush
-	//  what's in it to the new file
-	if(!log_fp && log_buf)
-	{
-		log_fp = fp;
-		fflush(fp);
-	}
-
-	// If we have a buffer free it
-	if((buf_size != buffer_size) && log_buf)
-		log_buf = (uint8_t *)realloc(log_buf, buffer_size);
-	else if(log_buf == NULL)
-		log_buf = (uint8_t *)malloc(buffer_size);
-
-	buf_size = buffer_size;
-	buf_ptr = 0;
-
-	// Store the log file pointer
-	log_fp = fp;
+	long pos = ftell(fp);
+	file_pos = (pos > 0) ? (uint32_t)pos : 0;
 
+	// The first log file gets everything still in the ring
+	if(!had_log)
+		flushed = ring->tail;
 
+	lazy_flush();
 	return 0;
 }
 
@@ -167,3 +334,28 @@ FILE *get_log_file()
 {
 	return log_fp;
 }
+
+/* Write out what is left and copy the ring to memory reserved for the kernel.
+ *  The ring itself stays in use for anything the kernel writes through the
+ *  functions table */
+const struct boot_log *log_finish(void)
+{
+	log_sync();
+	if(log_fp)
+		write_out(ring->head);
+
+	size_t size = sizeof(struct boot_log) + ring->size;
+	struct boot_log *l = (struct boot_log *)(uintptr_t)chunk_get_any_chunk((uint32_t)size);
+	if(!l)
+	{
+		printf("LOG: unable to allocate %i bytes\n", size);
+		return NULL;
+	}
+	memcpy(l, ring, size);
+	return l;
+}
+
+const struct boot_log *get_boot_log(void)
+{
+	return ring;
+}
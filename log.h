@@ -26,8 +26,18 @@
 
 #define LOG_DEFAULT_BUFFER_SIZE			512
 
+// Memory kept for the log records (a power of two)
+#define LOG_RING_SIZE					0x4000
+
+struct boot_log;
+
+void log_init(void);
 int log_putc(int c);
+int log_write(const char *buf, size_t len);
+int log_write_level(const char *buf, size_t len, int level);
 int register_log_file(FILE *fp, size_t buffer_size);
 FILE *get_log_file();
+const struct boot_log *log_finish(void);
+const struct boot_log *get_boot_log(void);
 
 #endif
@@ -36,6 +36,9 @@
 #include "output.h"
 #include "log.h"
 #include "rpifdt.h"
+#include "persist.h"
+#include "timer.h"
+#include "timeline.h"
 
 #define UNUSED(x) (void)(x)
 
@@ -78,12 +81,18 @@ void libfs_init();
 extern int (*stdout_putc)(int);
 extern int (*stderr_putc)(int);
 extern int (*stream_putc)(int, FILE*);
+extern int (*stdout_write)(const char *, size_t);
+extern int (*stderr_write)(const char *, size_t);
 extern int def_stream_putc(int, FILE*);
 
 int multiboot_cfg_parse(char *buf);
 
 int conf_source = 0;
 
+#ifdef ENABLE_SD
+extern uint32_t sd_first_read_us;
+#endif
+
 __attribute__((__weak__)) void find_and_run_config(void)
 {
 	// Look for a boot configuration file, starting with the default device,
@@ -176,6 +185,8 @@ void kernel_main(unsigned long boot_dev, unsigned long arm_m_type,
 	// First use the serial console
 	stdout_putc = split_putc;
 	stderr_putc = split_putc;
+	stdout_write = split_write;
+	stderr_write = split_write_err;
 	stream_putc = def_stream_putc;
 
 	output_init();
@@ -219,6 +230,33 @@ void kernel_main(unsigned long boot_dev, unsigned long arm_m_type,
 			break;
 	}
 
+#ifdef ENABLE_SD
+	// Now the timer base is known, record when we started for reporting SD
+	//  initialisation time
+	uint32_t start_us = timer_get_us();
+#endif
+
+#ifdef ENABLE_BOOT_TIMELINE
+	timeline_mark("kernel_main");
+#endif
+
+#ifdef ENABLE_PERSIST
+	// Keep the persistent area out of the way of loaded images.  Unless a
+	//  fixed address is configured it lives at the top of ARM memory, which
+	//  is the same on every boot of a given board and is the last place
+	//  images are loaded.
+#ifdef PERSIST_BASE
+	uint32_t persist_base = chunk_get_chunk(PERSIST_BASE, PERSIST_LENGTH);
+#else
+	uint32_t persist_base = chunk_get_aligned_chunk(PERSIST_LENGTH, 0x1000,
+			CHUNK_LAST_FIT);
+#endif
+	if(persist_base)
+		persist_init(persist_base);
+	else
+		printf("MAIN: unable to reserve persistent area\n");
+#endif
+
 	// dump arguments to main
 #ifdef DEBUG
 	printf("MAIN: boot_dev: %x, arm_m_type: %i, atags: %x\n", boot_dev,
@@ -226,9 +264,13 @@ void kernel_main(unsigned long boot_dev, unsigned long arm_m_type,
 #endif
 
 #ifdef ENABLE_FRAMEBUFFER
+#ifdef ENABLE_BOOT_TIMELINE
+	timeline_mark("fb_init");
+#endif
 	int result = fb_init();
 	if(result == 0)
 	{
+		console_init();
 		puts("Successfully set up frame buffer");
 #ifdef DEBUG2
 		printf("FB: width: %i, height: %i, bpp: %i\n",
@@ -246,9 +288,8 @@ void kernel_main(unsigned long boot_dev, unsigned long arm_m_type,
 	// Switch to the framebuffer for output
 	output_enable_fb();
 
-	// Allocate a log in memory
+	// Keep a log in memory
 #ifdef ENABLE_CONSOLE_LOGFILE
-	register_log_file(NULL, 0x1000);
 	output_enable_log();
 #endif
 
@@ -259,13 +300,28 @@ void kernel_main(unsigned long boot_dev, unsigned long arm_m_type,
 		printf("Command line: %s\n", atag_cmd_line);
 
     // Register the various file systems
+#ifdef ENABLE_BOOT_TIMELINE
+	timeline_mark("libfs_init");
+#endif
 	libfs_init();
 
+#ifdef ENABLE_SD
+	if(sd_first_read_us)
+		printf("MAIN: first SD block read %u us after kernel_main\n",
+			sd_first_read_us - start_us);
+#endif
+
 	// List devices
 	printf("MAIN: device list: ");
 	vfs_list_devices();
 	printf("\n");
 
+#ifdef ENABLE_BOOT_TIMELINE
+	timeline_mark("find_and_run_config");
+#endif
 	find_and_run_config();
+
+	// Nothing was booted, make sure the reason why is on screen
+	output_flush();
 }
 
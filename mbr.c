@@ -46,6 +46,8 @@ static char driver_name[] = "mbr";
 
 static int mbr_read(struct block_device *, uint8_t *buf, size_t buf_size, uint32_t starting_block);
 static int mbr_write(struct block_device *, uint8_t *buf, size_t buf_size, uint32_t starting_block);
+static int mbr_submit(struct block_device *, struct block_request *req);
+static int mbr_poll(struct block_device *);
 
 int read_mbr(struct block_device *parent, struct block_device ***partitions, int *part_count)
 {
@@ -159,6 +161,12 @@ int read_mbr(struct block_device *parent, struct block_device ***partitions, int
 			d->bd.read = mbr_read;
 			if(parent->write)
                 d->bd.write = mbr_write;
+			if(parent->submit)
+			{
+				d->bd.submit = mbr_submit;
+				d->bd.poll = mbr_poll;
+				d->bd.queue_depth = parent->queue_depth;
+			}
 			d->bd.block_size = parent->block_size;
 			d->bd.supports_multiple_block_read = parent->supports_multiple_block_read;
 			d->bd.supports_multiple_block_write = parent->supports_multiple_block_write;
@@ -187,6 +195,11 @@ int read_mbr(struct block_device *parent, struct block_device ***partitions, int
 			d->blocks /= block_size_adjust;
 			d->bd.num_blocks = d->blocks;
 
+			// Allocation units are only meaningful to the partition if it
+			//  starts on one
+			if(parent->au_blocks && ((d->start_block % parent->au_blocks) == 0))
+				d->bd.au_blocks = parent->au_blocks;
+
 			parts[cur_p++] = (struct block_device *)d;
 #ifdef MBR_DEBUG
 			printf("MBR: partition number %i (%s) of type %x, start sector %u, "
@@ -227,3 +240,16 @@ int mbr_write(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t
     return parent->write(parent, buf, buf_size,
                          starting_block + ((struct mbr_block_dev *)dev)->start_block);
 }
+
+int mbr_submit(struct block_device *dev, struct block_request *req)
+{
+    struct block_device *parent = ((struct mbr_block_dev *)dev)->parent;
+
+    req->block_num += ((struct mbr_block_dev *)dev)->start_block;
+    return block_submit(parent, req);
+}
+
+int mbr_poll(struct block_device *dev)
+{
+    return block_poll(((struct mbr_block_dev *)dev)->parent);
+}
@@ -0,0 +1,337 @@
+/* Copyright (C) 2016 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Word- and burst-sized memcpy, memset, memmove and memcmp.
+ *
+ * For most of its life the loader runs with the MMU off, so all memory is
+ * device/strongly-ordered and unaligned word accesses fault.  Every word
+ * access here is therefore naturally aligned: the destination is aligned
+ * with byte copies first and, if the source is then at a different offset
+ * within a word, aligned source words are merged with shifts.
+ *
+ * The aligned bulk is moved in bursts - ldm/stm of eight registers on
+ * 32-bit ARM, ldp/stp pairs on AArch64 - and large zero fills on AArch64
+ * use DC ZVA once the MMU is on.
+ *
+ * Nothing here depends on the rest of rpi-boot so the file can also be
+ * built for the host, see rpi-boot-tools/membench.c
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef uintptr_t __attribute__((__may_alias__)) word_t;
+
+#define WSIZE		sizeof(word_t)
+#define WMASK		(WSIZE - 1)
+#define WBITS		(WSIZE * 8)
+#define BURST_SIZE	(8 * WSIZE)
+
+// Below this the word loops are not worth setting up
+#define SMALL_SIZE	(2 * WSIZE)
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error mem.c assumes a little-endian target
+#endif
+
+#if defined(__aarch64__) && defined(BUILDING_RPIBOOT)
+#define USE_DC_ZVA
+uint32_t read_sctlr(void);
+#endif
+
+// Copy n bytes (a multiple of BURST_SIZE) between word aligned buffers
+static inline void copy_bursts(word_t *d, const word_t *s, size_t n)
+{
+	if(n == 0)
+		return;
+#ifdef __arm__
+	__asm__ volatile("1:\n\t"
+			"ldmia %1!, {r3-r10}\n\t"
+			"stmia %0!, {r3-r10}\n\t"
+			"subs %2, %2, #32\n\t"
+			"bne 1b\n\t"
+			: "+r" (d), "+r" (s), "+r" (n) :
+			: "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10",
+			"cc", "memory");
+#else
+	// GCC turns these into ldp/stp pairs on AArch64
+	while(n)
+	{
+		word_t a = s[0], b = s[1], c = s[2], e = s[3];
+		word_t f = s[4], g = s[5], h = s[6], i = s[7];
+		d[0] = a; d[1] = b; d[2] = c; d[3] = e;
+		d[4] = f; d[5] = g; d[6] = h; d[7] = i;
+		d += 8;
+		s += 8;
+		n -= BURST_SIZE;
+	}
+#endif
+}
+
+// Fill n bytes (a multiple of BURST_SIZE) of a word aligned buffer
+static inline void set_bursts(word_t *d, word_t pat, size_t n)
+{
+	if(n == 0)
+		return;
+#ifdef __arm__
+	__asm__ volatile("mov r3, %2\n\t"
+			"mov r4, %2\n\t"
+			"mov r5, %2\n\t"
+			"mov r6, %2\n\t"
+			"mov r7, %2\n\t"
+			"mov r8, %2\n\t"
+			"mov r9, %2\n\t"
+			"mov r10, %2\n\t"
+			"1:\n\t"
+			"stmia %0!, {r3-r10}\n\t"
+			"subs %1, %1, #32\n\t"
+			"bne 1b\n\t"
+			: "+r" (d), "+r" (n) : "r" (pat)
+			: "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10",
+			"cc", "memory");
+#else
+	while(n)
+	{
+		d[0] = pat; d[1] = pat; d[2] = pat; d[3] = pat;
+		d[4] = pat; d[5] = pat; d[6] = pat; d[7] = pat;
+		d += 8;
+		n -= BURST_SIZE;
+	}
+#endif
+}
+
+/* Copy whole words to an aligned destination from a source that is not
+ *  word aligned.  Only aligned words are read from the source, and none
+ *  beyond the one holding its last byte.  Returns the bytes copied. */
+static size_t copy_shifted(word_t *d, const uint8_t *s, size_t n)
+{
+	unsigned int shift = ((uintptr_t)s & WMASK) * 8;
+	const word_t *ws = (const word_t *)((uintptr_t)s & ~WMASK);
+	word_t w0 = *ws++;
+	size_t done = 0;
+
+	while(n - done >= WSIZE)
+	{
+		word_t w1 = *ws++;
+		*d++ = (w0 >> shift) | (w1 << (WBITS - shift));
+		w0 = w1;
+		done += WSIZE;
+	}
+	return done;
+}
+
+#ifdef USE_DC_ZVA
+static size_t zva_block;
+
+static int zva_usable(void)
+{
+	if(zva_block == 0)
+	{
+		uint64_t dczid;
+		__asm__ volatile("mrs %0, dczid_el0" : "=r" (dczid));
+		if(dczid & 0x10)
+			zva_block = 1;
+		else
+			zva_block = (size_t)4 << (dczid & 0xf);
+	}
+
+	// DC ZVA faults on device memory, i.e. whenever the MMU is off
+	return (zva_block >= BURST_SIZE) && (read_sctlr() & 1);
+}
+#endif
+
+/* This copies strictly forwards, including within a burst (all loads of
+ *  a burst come before its stores), which memmove relies on */
+void *memcpy(void *dest, const void *src, size_t n)
+{
+	uint8_t *d = (uint8_t *)dest;
+	const uint8_t *s = (const uint8_t *)src;
+
+	if(n >= SMALL_SIZE)
+	{
+		while((uintptr_t)d & WMASK)
+		{
+			*d++ = *s++;
+			n--;
+		}
+
+		size_t done;
+		if(((uintptr_t)s & WMASK) == 0)
+		{
+			done = n & ~(BURST_SIZE - 1);
+			copy_bursts((word_t *)d, (const word_t *)s, done);
+			while(n - done >= WSIZE)
+			{
+				*(word_t *)(d + done) = *(const word_t *)(s + done);
+				done += WSIZE;
+			}
+		}
+		else
+			done = copy_shifted((word_t *)d, s, n);
+
+		d += done;
+		s += done;
+		n -= done;
+	}
+
+	while(n--)
+		*d++ = *s++;
+	return dest;
+}
+
+void *memset(void *s, int c, size_t n)
+{
+	uint8_t *d = (uint8_t *)s;
+
+	if(n >= SMALL_SIZE)
+	{
+		word_t pat = ((word_t)~0 / 0xff) * (uint8_t)c;
+
+		while((uintptr_t)d & WMASK)
+		{
+			*d++ = (uint8_t)c;
+			n--;
+		}
+
+#ifdef USE_DC_ZVA
+		if((pat == 0) && (n >= 4 * BURST_SIZE) && zva_usable() &&
+				(n >= 4 * zva_block))
+		{
+			while((uintptr_t)d & (zva_block - 1))
+			{
+				*(word_t *)d = 0;
+				d += WSIZE;
+				n -= WSIZE;
+			}
+			while(n >= zva_block)
+			{
+				__asm__ volatile("dc zva, %0" : : "r" (d) : "memory");
+				d += zva_block;
+				n -= zva_block;
+			}
+		}
+#endif
+
+		size_t done = n & ~(BURST_SIZE - 1);
+		set_bursts((word_t *)d, pat, done);
+		while(n - done >= WSIZE)
+		{
+			*(word_t *)(d + done) = pat;
+			done += WSIZE;
+		}
+		d += done;
+		n -= done;
+	}
+
+	while(n--)
+		*d++ = (uint8_t)c;
+	return s;
+}
+
+void *memmove(void *dest, const void *src, size_t n)
+{
+	uint8_t *d = (uint8_t *)dest;
+	const uint8_t *s = (const uint8_t *)src;
+
+	// Forwards is safe unless the destination starts inside the source
+	if((d <= s) || (d >= s + n))
+		return memcpy(dest, src, n);
+
+	d += n;
+	s += n;
+
+	if((n >= SMALL_SIZE) && ((((uintptr_t)d ^ (uintptr_t)s) & WMASK) == 0))
+	{
+		while((uintptr_t)d & WMASK)
+		{
+			*--d = *--s;
+			n--;
+		}
+		while(n >= WSIZE)
+		{
+			d -= WSIZE;
+			s -= WSIZE;
+			*(word_t *)d = *(const word_t *)s;
+			n -= WSIZE;
+		}
+	}
+
+	while(n--)
+		*--d = *--s;
+	return dest;
+}
+
+int memcmp(const void *s1, const void *s2, size_t n)
+{
+	const uint8_t *a = (const uint8_t *)s1;
+	const uint8_t *b = (const uint8_t *)s2;
+
+	if(n >= SMALL_SIZE)
+	{
+		while((uintptr_t)a & WMASK)
+		{
+			if(*a != *b)
+				return *a - *b;
+			a++;
+			b++;
+			n--;
+		}
+
+		// Skip equal words, the byte loop then finds the difference
+		if(((uintptr_t)b & WMASK) == 0)
+		{
+			while((n >= WSIZE) && (*(const word_t *)a == *(const word_t *)b))
+			{
+				a += WSIZE;
+				b += WSIZE;
+				n -= WSIZE;
+			}
+		}
+		else
+		{
+			unsigned int shift = ((uintptr_t)b & WMASK) * 8;
+			const word_t *wb = (const word_t *)((uintptr_t)b & ~WMASK);
+			word_t w0 = *wb++;
+
+			while(n >= WSIZE)
+			{
+				word_t w1 = *wb++;
+				if(*(const word_t *)a != ((w0 >> shift) | (w1 << (WBITS - shift))))
+					break;
+				w0 = w1;
+				a += WSIZE;
+				b += WSIZE;
+				n -= WSIZE;
+			}
+		}
+	}
+
+	while(n--)
+	{
+		if(*a != *b)
+			return *a - *b;
+		a++;
+		b++;
+	}
+	return 0;
+}
@@ -20,108 +20,256 @@
  */
 
 #include "memchunk.h"
-#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Free memory is kept as a sorted array of non-overlapping, coalesced
+ * ranges, so an allocation at a fixed address is a binary search and a
+ * search for any free area only visits each free range once.  Allocations
+ * are recorded in a second sorted array so the final memory map can be
+ * printed and so memory registered late doesn't hand out used areas.
+ */
+
+#define CHUNK_MAX_FREE		64
+#define CHUNK_MAX_USED		128
 
 struct chunk
 {
 	uint32_t start;
-	uint32_t length;
-	struct chunk *next;
+	uint32_t end;		// exclusive
 };
 
-struct chunk *free_list = (void *)0;
-struct chunk *used = (void *)0;
+static struct chunk free_list[CHUNK_MAX_FREE];
+static int free_count = 0;
+static struct chunk used[CHUNK_MAX_USED];
+static int used_count = 0;
 
 uint32_t max_free = 0;
 
-// Add a chunk to a list
-static void chunk_add(uint32_t start, uint32_t length, struct chunk **list)
+// Return the index of the first entry which ends after addr
+static int chunk_find(struct chunk *list, int count, uint32_t addr)
 {
-	struct chunk *c = (struct chunk *)malloc(sizeof(struct chunk));
-	c->start = start;
-	c->length = length;
-	c->next = *list;
-	*list = c;
-}
-
-// Return 1 if the chunk overlaps an entry in a list, otherwise 0
-static int chunk_overlaps(uint32_t start, uint32_t length, struct chunk *list)
-{
-	while(list)
+	int lo = 0;
+	int hi = count;
+	while(lo < hi)
 	{
-		uint32_t l_start = list->start;
-		uint32_t l_end = l_start + list->length;
-		uint32_t end = start + length;
-
-		if((start < l_end) && (end > l_start))
-			return 1;
-
-		list = list->next;
+		int mid = (lo + hi) / 2;
+		if(list[mid].end <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+	return lo;
+}
 
+static int chunk_insert(struct chunk *list, int *count, int max, int idx,
+		uint32_t start, uint32_t end)
+{
+	if(*count >= max)
+		return -1;
+	memmove(&list[idx + 1], &list[idx], (*count - idx) * sizeof(struct chunk));
+	list[idx].start = start;
+	list[idx].end = end;
+	(*count)++;
 	return 0;
 }
 
-// Return 1 if the chunk is wholly contained within an entry in the list, otherwise 0
-static int chunk_contains(uint32_t start, uint32_t length, struct chunk *list)
+static void chunk_delete(struct chunk *list, int *count, int idx)
 {
-	while(list)
-	{
-		uint32_t l_start = list->start;
-		uint32_t l_end = l_start + list->length;
-		uint32_t end = start + length;
+	memmove(&list[idx], &list[idx + 1], (*count - idx - 1) * sizeof(struct chunk));
+	(*count)--;
+}
 
-		if((start >= l_start) && (end <= l_end))
-			return 1;
+// Remove [start, end) from the free list.  Returns -1 (and changes
+//  nothing) if it would need more entries than are available.
+static int chunk_remove_free(uint32_t start, uint32_t end)
+{
+	int i = chunk_find(free_list, free_count, start);
 
-		list = list->next;
-	}
+	// Splitting a range in two needs a new entry
+	if((i < free_count) && (free_list[i].start < start) &&
+			(free_list[i].end > end) && (free_count >= CHUNK_MAX_FREE))
+		return -1;
 
+	while((i < free_count) && (free_list[i].start < end))
+	{
+		struct chunk *c = &free_list[i];
+		if((c->start < start) && (c->end > end))
+		{
+			chunk_insert(free_list, &free_count, CHUNK_MAX_FREE, i + 1,
+					end, c->end);
+			c->end = start;
+			return 0;
+		}
+		if(c->start < start)
+		{
+			c->end = start;
+			i++;
+		}
+		else if(c->end > end)
+		{
+			c->start = end;
+			return 0;
+		}
+		else
+			chunk_delete(free_list, &free_count, i);
+	}
 	return 0;
 }
 
-// Return 1 if can allocate, otherwise 0
-static int chunk_can_allocate(uint32_t start, uint32_t length)
+static uint32_t chunk_allocate(uint32_t start, uint32_t length)
 {
-	if(!chunk_contains(start, length, free_list))
+	if(length == 0)
+		return start;
+
+	// An allocation which cannot be recorded could never be freed, and
+	//  would be handed out again by chunk_register_free()
+	if(used_count >= CHUNK_MAX_USED)
+	{
+		printf("MEMCHUNK: too many allocations to record\n");
 		return 0;
-	if(chunk_overlaps(start, length, used))
+	}
+	if(chunk_remove_free(start, start + length) != 0)
+	{
+		printf("MEMCHUNK: too many free ranges\n");
 		return 0;
-	return 1;
+	}
+
+	int i = chunk_find(used, used_count, start);
+	chunk_insert(used, &used_count, CHUNK_MAX_USED, i, start, start + length);
+	return start;
 }
 
 void chunk_register_free(uint32_t start, uint32_t length)
 {
-	chunk_add(start, length, &free_list);
+	uint32_t end = start + length;
+	if(end < start)
+		end = 0xfffff000;
+	if(end <= start)
+		return;
+
+	// Kept so the registration can be undone if it cannot be completed
+	static struct chunk saved[CHUNK_MAX_FREE];
+	int saved_count = free_count;
+	memcpy(saved, free_list, free_count * sizeof(struct chunk));
+	uint32_t reg_start = start, reg_end = end;
 
-	if((start + length) > max_free)
-		max_free = start + length;
+	// Merge with any ranges it overlaps or touches
+	int i = chunk_find(free_list, free_count, start);
+	if((i > 0) && (free_list[i - 1].end == start))
+		i--;
+	while((i < free_count) && (free_list[i].start <= end))
+	{
+		if(free_list[i].start < start)
+			start = free_list[i].start;
+		if(free_list[i].end > end)
+			end = free_list[i].end;
+		chunk_delete(free_list, &free_count, i);
+	}
+	if(chunk_insert(free_list, &free_count, CHUNK_MAX_FREE, i, start, end) != 0)
+	{
+		printf("MEMCHUNK: too many free ranges, ignoring 0x%08x-0x%08x\n",
+				start, end);
+		return;
+	}
+
+	// Don't give out anything which has already been allocated
+	for(int j = 0; j < used_count; j++)
+	{
+		if(chunk_remove_free(used[j].start, used[j].end) != 0)
+		{
+			printf("MEMCHUNK: too many free ranges, ignoring 0x%08x-0x%08x\n",
+					reg_start, reg_end);
+			memcpy(free_list, saved, saved_count * sizeof(struct chunk));
+			free_count = saved_count;
+			return;
+		}
+	}
+
+	if(end > max_free)
+		max_free = end;
 }
 
-uint32_t chunk_get_any_chunk(uint32_t length)
+uint32_t chunk_get_aligned_chunk(uint32_t length, uint32_t align, int flags)
 {
-	uint32_t test_address = 0;
-	while(test_address < max_free)
+	if(align == 0)
+		align = 1;
+
+	int best = -1;
+	uint32_t best_addr = 0;
+	uint32_t best_left = 0;
+
+	if(flags & CHUNK_LAST_FIT)
 	{
-		if(chunk_can_allocate(test_address, length))
+		for(int i = free_count - 1; i >= 0; i--)
 		{
-			chunk_add(test_address, length, &used);
-			return test_address;
+			if(free_list[i].end - free_list[i].start < length)
+				continue;
+			uint32_t addr = (free_list[i].end - length) & ~(align - 1);
+			if(addr >= free_list[i].start)
+				return chunk_allocate(addr, length);
 		}
-		test_address += 0x1000;	// Returned page aligned chunks
+		return 0;
 	}
-	
-	return 0;
+
+	for(int i = 0; i < free_count; i++)
+	{
+		uint32_t addr = (free_list[i].start + align - 1) & ~(align - 1);
+		if((addr < free_list[i].start) || (addr >= free_list[i].end) ||
+				(free_list[i].end - addr < length))
+			continue;
+
+		uint32_t left = free_list[i].end - addr - length;
+		if((best == -1) || (left < best_left))
+		{
+			best = i;
+			best_addr = addr;
+			best_left = left;
+		}
+		if(!(flags & CHUNK_BEST_FIT) || (left == 0))
+			break;
+	}
+
+	if(best == -1)
+		return 0;
+	return chunk_allocate(best_addr, length);
+}
+
+uint32_t chunk_get_any_chunk(uint32_t length)
+{
+	return chunk_get_aligned_chunk(length, 0x1000, CHUNK_FIRST_FIT);
 }
 
 uint32_t chunk_get_chunk(uint32_t start, uint32_t length)
 {
-	if(chunk_can_allocate(start, length))
-	{
-		chunk_add(start, length, &used);
-		return start;
-	}
-	return 0;
+	// The whole area must lie within a single free range
+	int i = chunk_find(free_list, free_count, start);
+	if((i >= free_count) || (free_list[i].start > start) ||
+			(free_list[i].end - start < length))
+		return 0;
+	return chunk_allocate(start, length);
 }
 
+// Return a chunk allocated at start to the free list
+void chunk_free(uint32_t start)
+{
+	int i = chunk_find(used, used_count, start);
+	if((i >= used_count) || (used[i].start != start))
+		return;
+
+	uint32_t end = used[i].end;
+	chunk_delete(used, &used_count, i);
+	chunk_register_free(start, end - start);
+}
 
+void chunk_dump(void)
+{
+	printf("MEMCHUNK: allocated:\n");
+	for(int i = 0; i < used_count; i++)
+		printf("MEMCHUNK:  0x%08x-0x%08x (%i kiB)\n", used[i].start,
+				used[i].end, (used[i].end - used[i].start) / 1024);
+	printf("MEMCHUNK: free:\n");
+	for(int i = 0; i < free_count; i++)
+		printf("MEMCHUNK:  0x%08x-0x%08x (%i kiB)\n", free_list[i].start,
+				free_list[i].end, (free_list[i].end - free_list[i].start) / 1024);
+}
@@ -26,9 +26,17 @@
 
 #include <stdint.h>
 
+// Flags for chunk_get_aligned_chunk()
+#define CHUNK_FIRST_FIT		0	// lowest suitable address
+#define CHUNK_BEST_FIT		1	// smallest suitable free range
+#define CHUNK_LAST_FIT		2	// highest suitable address
+
 void chunk_register_free(uint32_t start, uint32_t length);
 uint32_t chunk_get_any_chunk(uint32_t length);
+uint32_t chunk_get_aligned_chunk(uint32_t length, uint32_t align, int flags);
 uint32_t chunk_get_chunk(uint32_t start, uint32_t length);
+void chunk_free(uint32_t start);
+void chunk_dump(void);
 
 #endif
 
@@ -37,11 +37,47 @@
 #include "timer.h"
 #include "output.h"
 #include "log.h"
+#ifdef ENABLE_SERIAL
+#include "uart.h"
+#endif
+#ifdef ENABLE_RASPBOOTIN
+#include "raspbootin.h"
+#endif
+#ifdef ENABLE_DECOMPRESS
+#include "decompress.h"
+#endif
+#ifdef ENABLE_LOAD_PIPELINE
+#include "loadpipe.h"
+#endif
+#ifdef ENABLE_LINUX_BOOT
+#include "linux.h"
+#endif
+#ifdef ENABLE_FAST_REBOOT
+#include "retain.h"
+#endif
+#ifdef ENABLE_BOOT_TIMELINE
+#include "timeline.h"
+#endif
+#ifdef ENABLE_IMAGE_CACHE
+#include "imgcache.h"
+#endif
 
 #ifdef DEBUG2
 #define MULTIBOOT_DEBUG
 #endif
 
+// Retained images, and cache indices waiting for confirmation, are recorded
+//  in the persistent area
+#ifndef ENABLE_PERSIST
+#undef ENABLE_FAST_REBOOT
+#undef ENABLE_IMAGE_CACHE
+#endif
+
+// Images may be reused from a previous boot
+#if defined(ENABLE_FAST_REBOOT) || defined(ENABLE_IMAGE_CACHE)
+#define IMAGE_REUSE
+#endif
+
 static int method_multiboot(char *args);
 static int method_boot(char *args);
 static int method_module(char *args);
@@ -49,9 +85,33 @@ static int method_kernel(char *args);
 static int method_entry_addr(char *args);
 static int method_binary_load_addr(char *args);
 static int method_console_log(char *args);
+static int method_lazy_module(char *args);
+#ifdef ENABLE_IMAGE_CACHE
+static int method_image_cache(char *args);
+#endif
+#ifdef ENABLE_LINUX_BOOT
+static int method_initrd(char *args);
+static int method_dtb(char *args);
+#endif
+#ifdef ENABLE_SERIAL
+static int method_baud(char *args);
+#endif
 
 static void mem_cb(uint32_t addr, uint32_t len);
 static void mem_cb2(uint32_t addr, uint32_t len);
+static int elf_segment_regions(Elf32_Ehdr *ehdr, uint8_t *ph_buf, struct elf32_region *regions);
+#ifdef ENABLE_DECOMPRESS
+static FILE *open_compressed(FILE *fp, uint8_t *probe, size_t *probe_len, const char *name);
+#endif
+static size_t module_read(const struct module *mod, void *ptr, size_t offset, size_t length);
+static void load_start(void);
+static void load_done(const char *name, size_t bytes);
+#ifdef IMAGE_REUSE
+static uint32_t image_reuse(const struct image_key *key, uint32_t addr, uint32_t *length, const char *name);
+static void image_loaded(const struct image_key *key, uint32_t addr, uint32_t length);
+#endif
+static int fextent(FILE *fp, long offset, size_t max_length, struct block_device **dev,
+		uint32_t *block_num, size_t *length);
 
 extern uintptr_t _atags;
 extern unsigned long _arm_m_type;
@@ -76,6 +136,16 @@ static struct config_parse_method methods[] =
 		.name = "module",
 		.method = method_module
 	},
+	{
+		.name = "lazy_module",
+		.method = method_lazy_module
+	},
+#ifdef ENABLE_IMAGE_CACHE
+	{
+		.name = "image_cache",
+		.method = method_image_cache
+	},
+#endif
 	{
 		.name = "kernel",
 		.method = method_kernel
@@ -92,6 +162,22 @@ static struct config_parse_method methods[] =
 		.name = "console_log",
 		.method = method_console_log
 	},
+#ifdef ENABLE_LINUX_BOOT
+	{
+		.name = "initrd",
+		.method = method_initrd
+	},
+	{
+		.name = "dtb",
+		.method = method_dtb
+	},
+#endif
+#ifdef ENABLE_SERIAL
+	{
+		.name = "baud",
+		.method = method_baud
+	},
+#endif
 	{
 		.name = NULL,
 	},
@@ -119,6 +205,21 @@ int ramdisk_init(uintptr_t address, size_t size, int fs_type, char *name)
 }
 #endif
 
+#ifndef ENABLE_BOOT_TIMELINE
+const struct boot_timeline *get_boot_timeline()
+{
+	return NULL;
+}
+#endif
+
+// Called by the kernel once it has booted successfully
+static void confirm_boot()
+{
+#ifdef ENABLE_IMAGE_CACHE
+	imgcache_confirm();
+#endif
+}
+
 #ifndef ENABLE_CONSOLE_LOGFILE
 int register_log_file(FILE *fp, size_t buffer_size)
 {
@@ -129,6 +230,10 @@ FILE *get_log_file()
 {
 	return NULL;
 }
+const struct boot_log *get_boot_log()
+{
+	return NULL;
+}
 #endif
 
 struct multiboot_arm_functions funcs =
@@ -163,7 +268,20 @@ struct multiboot_arm_functions funcs =
 	.register_log_file = register_log_file,
 	.get_log_file = get_log_file,
 	.ramdisk_init = ramdisk_init,
-	.mb_arm_version = mb_arm_version
+	.mb_arm_version = mb_arm_version,
+	.get_boot_timeline = get_boot_timeline,
+	.module_read = module_read,
+	.get_device_list = vfs_get_device_list,
+	.get_block_device = vfs_get_block_device,
+	.block_read = block_read,
+	.block_write = block_write,
+	.block_submit = block_submit,
+	.block_poll = block_poll,
+	.block_wait = block_wait,
+	.fextent = fextent,
+	.register_custom_output_write_function = register_custom_output_write_function,
+	.get_boot_log = get_boot_log,
+	.confirm_boot = confirm_boot
 };
 
 int multiboot_cfg_parse(char *buf)
@@ -329,19 +447,19 @@ int method_multiboot(char *args)
 			return -1;
 		}
 
-		uint8_t *sh_buf;
-		retno = elf32_read_shdrs(fp, ehdr, &sh_buf);
+		uint8_t *ph_buf;
+		retno = elf32_read_phdrs(fp, ehdr, &ph_buf);
 		if(retno != ELF_OK)
 		{
 			free(ehdr);
 			fclose(fp);
 			return retno;
 		}
-		uint8_t *ph_buf;
-		retno = elf32_read_phdrs(fp, ehdr, &ph_buf);
+		uint8_t *sh_buf;
+		retno = elf32_read_shdrs(fp, ehdr, &sh_buf);
 		if(retno != ELF_OK)
 		{
-			free(sh_buf);
+			free(ph_buf);
 			free(ehdr);
 			fclose(fp);
 			return retno;
@@ -351,10 +469,24 @@ int method_multiboot(char *args)
 
 		// Now interpret and load them
 		//
-		// We do two passes - first loading the segments from prog headers to their
-		// appropriate addresses, then loading the others (Multiboot requires
-		// we load all sections).  This ensures we don't load the sections not
-		// marked ALLOC to an address that a later section requires.
+		// We first allocate the segments from prog headers at their
+		// appropriate addresses, then the others (Multiboot requires we load
+		// all sections).  This ensures we don't load the sections not marked
+		// ALLOC to an address that a later section requires.  Everything is
+		// then read in a single pass through the file.
+
+		struct elf32_region *regions = (struct elf32_region *)malloc(
+				(ehdr->e_phnum + ehdr->e_shnum) * sizeof(struct elf32_region));
+		int region_count = elf_segment_regions(ehdr, ph_buf, regions);
+		if(region_count < 0)
+		{
+			free(regions);
+			free(ehdr);
+			free(sh_buf);
+			free(ph_buf);
+			fclose(fp);
+			return -1;
+		}
 
 		for(unsigned int i = 0; i < ehdr->e_phnum; i++)
 		{
@@ -363,32 +495,8 @@ int method_multiboot(char *args)
 			if(phdr->p_type != PT_LOAD)
 				continue;
 
-			uint32_t start = (uint32_t)phdr->p_paddr;
-			uint32_t length = (uint32_t)phdr->p_memsz;
-
-			// Check we can load to this address
-			if(!chunk_get_chunk(start, length))
-			{
-				free(ehdr);
-				free(sh_buf);
-				free(ph_buf);
-				fclose(fp);
-				return retno;
-			}
-
-			// Load the segment
-			retno = elf32_load_segment(fp, phdr);
-			if(retno != ELF_OK)
-			{
-				free(ehdr);
-				free(sh_buf);
-				free(ph_buf);
-				fclose(fp);
-				return retno;
-			}
-
 #ifdef MULTIBOOT_DEBUG
-			printf("MULTIBOOT: segment at %x\n", start);
+			printf("MULTIBOOT: segment at %x\n", phdr->p_paddr);
 #endif
 
 			// Is there an entry point contained within this segment?
@@ -411,6 +519,16 @@ int method_multiboot(char *args)
 			{
 				if(shdr->sh_size)
 				{
+					if((shdr->sh_type != SHT_NOBITS) && !shdr->sh_offset)
+					{
+						free(regions);
+						free(ehdr);
+						free(sh_buf);
+						free(ph_buf);
+						fclose(fp);
+						return ELF_NO_OFFSET;
+					}
+
 					uint32_t load_addr = chunk_get_any_chunk(shdr->sh_size);
 
 					if(!load_addr)
@@ -422,13 +540,12 @@ int method_multiboot(char *args)
 					}
 
 					shdr->sh_addr = load_addr;
-					retno = elf32_load_section(fp, shdr);
-					if(retno != ELF_OK)
-					{
-						free(ehdr);
-						free(sh_buf);
-						return retno;
-					}
+
+					struct elf32_region *r = &regions[region_count++];
+					r->offset = shdr->sh_offset;
+					r->filesz = (shdr->sh_type == SHT_NOBITS) ? 0 : shdr->sh_size;
+					r->memsz = shdr->sh_size;
+					r->dest = (void *)(uintptr_t)load_addr;
 
 #ifdef MULTIBOOT_DEBUG
 					printf("MULTIBOOT: section %i at %x\n", i, load_addr);
@@ -437,6 +554,17 @@ int method_multiboot(char *args)
 			}
 		}
 
+		retno = elf32_load_regions(fp, regions, region_count);
+		free(regions);
+		if(retno != ELF_OK)
+		{
+			free(ehdr);
+			free(sh_buf);
+			free(ph_buf);
+			fclose(fp);
+			return retno;
+		}
+
 		// Set the ELF flags
 		mbinfo->u.elf_sec.num = ehdr->e_shnum;
 		mbinfo->u.elf_sec.size = ehdr->e_shentsize;
@@ -494,6 +622,7 @@ struct _module {
 	uint32_t start;
 	uint32_t end;
 	char *name;
+	char *path;			// lazy modules only
 	struct _module *next;
 };
 
@@ -502,10 +631,11 @@ int mod_count = 0;
 
 static void module_add(uint32_t start, uint32_t end, char *name)
 {
-	struct _module *m = (struct _module *)malloc(sizeof(struct module));
+	struct _module *m = (struct _module *)malloc(sizeof(struct _module));
 	m->start = start;
 	m->end = end;
 	m->name = name;
+	m->path = NULL;
 	m->next = first_mod;
 	first_mod = m;
 	mod_count++;
@@ -523,7 +653,7 @@ static void add_multiboot_modules()
 		mmod->mod_start = cur_mod->start;
 		mmod->mod_end = cur_mod->end;
 		mmod->string = (uintptr_t)cur_mod->name;
-		mmod->reserved = 0;
+		mmod->reserved = (uintptr_t)cur_mod->path;
 
 		cur_mod = cur_mod->next;
 
@@ -547,6 +677,35 @@ int method_module(char *args)
 		return -1;
 	}
 
+#ifdef IMAGE_REUSE
+	// Use a copy from a previous boot if the file is unchanged
+	struct image_key key;
+	int have_key = (image_key(fp, file, &key) == 0);
+	uint32_t reused_len;
+	uint32_t reused = have_key ? image_reuse(&key, 0, &reused_len, name) : 0;
+	if(reused)
+	{
+		fclose(fp);
+		module_add(reused, reused + reused_len, name);
+		return 0;
+	}
+#endif
+
+	load_start();
+#ifdef ENABLE_LOAD_PIPELINE
+	fp = pipe_fopen(fp);
+#endif
+
+#ifdef ENABLE_DECOMPRESS
+	// Check for a compressed module
+	uint8_t probe[0x30];
+	size_t probe_len = fread(probe, 1, sizeof(probe), fp);
+	fp = open_compressed(fp, probe, &probe_len, name);
+	if(!fp)
+		return -1;
+	fseek(fp, 0, SEEK_SET);
+#endif
+
 	// Allocate a chunk for it
 	uintptr_t address = chunk_get_any_chunk((uint32_t)fp->len);
 	if(!address)
@@ -569,11 +728,237 @@ int method_module(char *args)
 	}
 
 	module_add(address, address + (uint32_t)bytes_read, name);
+#ifdef IMAGE_REUSE
+	if(have_key)
+		image_loaded(&key, address, (uint32_t)bytes_read);
+#endif
+
+	load_done(name, bytes_read);
 
 	printf("MODULE: %s loaded\n", name);
 	return 0;
 }
 
+/* Time a file load for the load statistics (with the load pipeline) and the
+ * boot timeline.  Loads which reuse an image from a previous boot are not
+ * recorded. */
+static void load_start(void)
+{
+#ifdef ENABLE_LOAD_PIPELINE
+	load_stats_start();
+#endif
+#ifdef ENABLE_BOOT_TIMELINE
+	timeline_file_start();
+#endif
+}
+
+static void load_done(const char *name, size_t bytes)
+{
+#ifdef ENABLE_LOAD_PIPELINE
+	load_stats_print(name, bytes);
+#endif
+#ifdef ENABLE_BOOT_TIMELINE
+	timeline_file_end(name, (uint32_t)bytes);
+#endif
+#if !defined(ENABLE_LOAD_PIPELINE) && !defined(ENABLE_BOOT_TIMELINE)
+	(void)name; (void)bytes;
+#endif
+}
+
+#ifdef IMAGE_REUSE
+/* Look for a copy of an image from a previous boot, first in memory after a
+ * warm reboot and then in the image cache.  If one is found it is reserved
+ * (at addr, if that is not 0) and its address returned, otherwise 0.
+ */
+static uint32_t image_reuse(const struct image_key *key, uint32_t addr, uint32_t *length, const char *name)
+{
+	uint32_t reused;
+
+#ifdef ENABLE_FAST_REBOOT
+	reused = retain_reuse(key, addr, length);
+	if(reused)
+	{
+#ifdef ENABLE_IMAGE_CACHE
+		imgcache_add(key, reused, *length);
+#endif
+		printf("MULTIBOOT: %s reused from memory\n", name);
+		return reused;
+	}
+#endif
+
+#ifdef ENABLE_IMAGE_CACHE
+	int idx = imgcache_lookup(key, length);
+	if(idx < 0)
+		return 0;
+
+	if(addr)
+		reused = chunk_get_chunk(addr, *length);
+	else
+		reused = chunk_get_any_chunk(*length);
+	if(!reused)
+		return 0;
+
+	if(imgcache_read(idx, (void *)(uintptr_t)reused) != 0)
+	{
+		chunk_free(reused);
+		return 0;
+	}
+
+	image_loaded(key, reused, *length);
+	printf("MULTIBOOT: %s loaded from the image cache\n", name);
+	return reused;
+#else
+	(void)addr; (void)length; (void)name;
+	return 0;
+#endif
+}
+
+// Record an image loaded on this boot so later boots can reuse it
+static void image_loaded(const struct image_key *key, uint32_t addr, uint32_t length)
+{
+#ifdef ENABLE_FAST_REBOOT
+	retain_add(key, addr, length);
+#endif
+#ifdef ENABLE_IMAGE_CACHE
+	imgcache_add(key, addr, length);
+#endif
+}
+#endif
+
+#ifdef ENABLE_IMAGE_CACHE
+int method_image_cache(char *args)
+{
+	char *dev, *rest;
+	split_string(args, ' ', &dev, &rest);
+	return imgcache_open(dev);
+}
+#endif
+
+// Register a module without loading it.  The kernel reads it later with
+//  module_read().
+int method_lazy_module(char *args)
+{
+	char *file, *name;
+	split_string(args, ' ', &file, &name);
+
+	if(!strcmp(name, empty_string))
+		name = file;
+
+	FILE *fp = fopen(file, "r");
+	if(!fp)
+	{
+		printf("LAZY_MODULE: cannot find file %s\n", name);
+		return -1;
+	}
+	uint32_t length = (uint32_t)fp->len;
+
+	// Qualify the path with its device so it doesn't depend on the default
+	char *path = file;
+	if(file[0] != '(')
+	{
+		char *dev = fp->fs->parent->device_name;
+		path = (char *)malloc(strlen(dev) + strlen(file) + 3);
+		path[0] = 0;
+		strcat(path, "(");
+		strcat(path, dev);
+		strcat(path, ")");
+		strcat(path, file);
+	}
+	fclose(fp);
+
+	module_add(0, length, name);
+	first_mod->path = path;
+
+	printf("LAZY_MODULE: %s registered (%i bytes)\n", name, length);
+	return 0;
+}
+
+// Read part of a module, from memory or, for lazy modules, from its file
+static size_t module_read(const struct module *mod, void *ptr, size_t offset, size_t length)
+{
+	size_t size = mod->mod_end - mod->mod_start;
+	if(offset >= size)
+		return 0;
+	if(length > size - offset)
+		length = size - offset;
+
+	if(!mod->reserved)
+	{
+		memcpy(ptr, (const void *)(uintptr_t)(mod->mod_start + offset), length);
+		return length;
+	}
+
+	FILE *fp = fopen((const char *)(uintptr_t)mod->reserved, "r");
+	if(!fp)
+		return 0;
+#ifdef ENABLE_LOAD_PIPELINE
+	// Large reads are then split into asynchronous multi-block requests
+	fp = pipe_fopen(fp);
+#endif
+	size_t bytes_read = 0;
+	if(fseek(fp, (long)offset, SEEK_SET) == 0)
+		bytes_read = fread(ptr, 1, length, fp);
+	fclose(fp);
+	return bytes_read;
+}
+
+// Find where the data at offset in a file is on its block device, so the
+//  kernel can read it directly.  See fs_fmap().
+static int fextent(FILE *fp, long offset, size_t max_length, struct block_device **dev,
+		uint32_t *block_num, size_t *length)
+{
+	if(!fp || !fp->fs->fmap)
+		return -1;
+	*dev = fp->fs->parent;
+	return fp->fs->fmap(fp, offset, max_length, block_num, length);
+}
+
+#ifdef ENABLE_LINUX_BOOT
+int method_initrd(char *args)
+{
+	char *file, *rest;
+	split_string(args, ' ', &file, &rest);
+
+	FILE *fp = fopen(file, "r");
+	if(!fp)
+	{
+		printf("INITRD: cannot load file %s\n", file);
+		return -1;
+	}
+
+	load_start();
+#ifdef ENABLE_LOAD_PIPELINE
+	fp = pipe_fopen(fp);
+#endif
+
+	int retno = linux_load_initrd(fp, file);
+	if(retno == 0)
+		load_done(file, fp->len);
+	fclose(fp);
+	return retno;
+}
+
+int method_dtb(char *args)
+{
+	char *file, *rest;
+	split_string(args, ' ', &file, &rest);
+
+	FILE *fp = fopen(file, "r");
+	if(!fp)
+	{
+		printf("DTB: cannot load file %s\n", file);
+		return -1;
+	}
+
+	load_start();
+	int retno = linux_load_dtb(fp, file);
+	if(retno == 0)
+		load_done(file, fp->len);
+	fclose(fp);
+	return retno;
+}
+#endif
+
 int method_boot(char *args)
 {
 #ifdef MULTIBOOT_DEBUG
@@ -587,12 +972,45 @@ int method_boot(char *args)
 		return -1;
 	}
 
+#ifdef ENABLE_IMAGE_CACHE
+	imgcache_update();
+#endif
+
+#ifdef ENABLE_BOOT_TIMELINE
+	// Multiboot kernels also find the timeline in the module list
+	const struct boot_timeline *timeline = timeline_finish();
+	if(timeline && mbinfo)
+		module_add((uintptr_t)timeline,
+				(uintptr_t)&timeline->entries[timeline->count],
+				(char *)"rpi-boot-timeline");
+#endif
+
+#ifdef ENABLE_CONSOLE_LOGFILE
+	// Write out the rest of the log, and give Multiboot kernels a copy of
+	//  the ring as a module
+	const struct boot_log *boot_log = log_finish();
+	if(boot_log && mbinfo)
+		module_add((uintptr_t)boot_log,
+				(uintptr_t)&boot_log->data[boot_log->size],
+				(char *)"rpi-boot-log");
+#endif
+
+#ifdef MULTIBOOT_DEBUG
+	chunk_dump();
+#endif
+
+#ifdef ENABLE_LINUX_BOOT
+	if(linux_is_loaded())
+		return linux_boot(entry_addr);
+#endif
+
 	if(mbinfo)
 	{
 		add_multiboot_modules();
 
 		// Do a multiboot load
 		printf("BOOT: multiboot load\n");
+		output_handover();
 
 		void (*e_point)(uint32_t, uint32_t, uint32_t, uint32_t) =
 			(void(*)(uint32_t, uint32_t, uint32_t, uint32_t))entry_addr;
@@ -603,6 +1021,7 @@ int method_boot(char *args)
 	{
 		// Do a simple jump
 		printf("BOOT: non-multiboot load\n");
+		output_handover();
 
 		void (*e_point)(uint32_t, uint32_t, uint32_t, uint32_t) =
 			(void(*)(uint32_t, uint32_t, uint32_t, uint32_t))entry_addr;
@@ -623,9 +1042,32 @@ int method_kernel(char *args)
 		return -1;
 	}
 
-	// Load up the first 0x30 bytes to determine the kernel type
-	uint8_t *first_bytes = (uint8_t *)malloc(0x30);
-	size_t bytes_to_read = 0x30;
+#ifdef IMAGE_REUSE
+	// Only flat binaries are recorded, as ELF kernels are loaded in several
+	//  pieces and have their bss cleared
+	struct image_key key;
+	int have_key = (image_key(fp, file, &key) == 0);
+	uint32_t reused_len;
+	uint32_t reused = have_key ? image_reuse(&key, binary_load_addr,
+			&reused_len, file) : 0;
+	if(reused)
+	{
+		fclose(fp);
+		binary_load_addr = reused;
+		if(!entry_addr)
+			entry_addr = binary_load_addr;
+		return 0;
+	}
+#endif
+
+	load_start();
+#ifdef ENABLE_LOAD_PIPELINE
+	fp = pipe_fopen(fp);
+#endif
+
+	// Load up the first 0x40 bytes to determine the kernel type
+	uint8_t *first_bytes = (uint8_t *)malloc(0x40);
+	size_t bytes_to_read = 0x40;
 	size_t bytes_read = fread(first_bytes, 1, bytes_to_read, fp);
 	if(bytes_read <= 0)
 	{
@@ -634,6 +1076,17 @@ int method_kernel(char *args)
 		return -1;
 	}
 
+#ifdef ENABLE_DECOMPRESS
+	// Compressed kernels are decompressed as they are loaded, the rest of
+	//  the loader sees the uncompressed image
+	fp = open_compressed(fp, first_bytes, &bytes_read, file);
+	if(!fp)
+	{
+		free(first_bytes);
+		return -1;
+	}
+#endif
+
 	int kernel_type = 0;	// 0 = flat binary, 1 = ELF, 2 = linux
 
 	// If the first 4 bytes are the ELF magic number, assume its ELF
@@ -644,6 +1097,9 @@ int method_kernel(char *args)
 	else if((bytes_read >= 0x30) &&
 			(*(uint32_t *)&first_bytes[0x24] == 0x016F2818))
 		kernel_type = 2;
+	else if((bytes_read >= 0x40) &&
+			(*(uint32_t *)&first_bytes[0x38] == 0x644d5241))	// arm64 Image
+		kernel_type = 2;
 
 	free(first_bytes);
 
@@ -687,6 +1143,12 @@ int method_kernel(char *args)
 		}
 		fclose(fp);
 
+		load_done(file, length);
+#ifdef IMAGE_REUSE
+		if(have_key)
+			image_loaded(&key, binary_load_addr, length);
+#endif
+
         // Set the entry point to the beginning of the file (if not already set)
         if(!entry_addr)
             entry_addr = binary_load_addr;
@@ -713,48 +1175,111 @@ int method_kernel(char *args)
 			return retno;
 		}
 
-		for(int i = 0; i < ehdr->e_phnum; i++)
+		// Load all the segments in a single pass through the file
+		struct elf32_region *regions = (struct elf32_region *)malloc(
+				ehdr->e_phnum * sizeof(struct elf32_region));
+		int region_count = elf_segment_regions(ehdr, ph_buf, regions);
+		if(region_count < 0)
+			retno = -1;
+		else
+			retno = elf32_load_regions(fp, regions, region_count);
+		free(regions);
+		free(ph_buf);
+		if(retno != ELF_OK)
 		{
-			Elf32_Phdr *phdr =
-				(Elf32_Phdr *)&ph_buf[i * ehdr->e_phentsize];
-
-			if(phdr->p_type != PT_LOAD)
-				continue;
-
-			uint32_t start = (uint32_t)phdr->p_paddr;
-			uint32_t length = (uint32_t)phdr->p_memsz;
-
-			// Check we can load to this address
-			if(!chunk_get_chunk(start, length))
-			{
-				free(ehdr);
-				free(ph_buf);
-				fclose(fp);
-				return retno;
-			}
-
-			// Load the segment
-			retno = elf32_load_segment(fp, phdr);
-			if(retno != ELF_OK)
-			{
-				free(ehdr);
-				free(ph_buf);
-				fclose(fp);
-				return retno;
-			}
+			free(ehdr);
+			fclose(fp);
+			return retno;
 		}
 
 		entry_addr = ehdr->e_entry;
+		free(ehdr);
+		load_done(file, fp->len);
+		fclose(fp);
 	}
 	else if (kernel_type == 2)
 	{
+#ifdef ENABLE_LINUX_BOOT
+		// The rest of the line is the kernel command line
+		int retno = linux_load_kernel(fp, file, name, &entry_addr);
+		if(retno == 0)
+			load_done(file, fp->len);
+		fclose(fp);
+		return retno;
+#else
 		printf("KERNEL: Linux kernels not currently supported\n");
+		fclose(fp);
 		return -1;
+#endif
 	}
 
 	return 0;
 }
 
+#ifdef ENABLE_DECOMPRESS
+/* If the first bytes of a file (in probe) show it is compressed, return a
+ * file which reads the decompressed data, with probe refilled from it.
+ * Returns fp if it is not compressed, or NULL on error (fp is closed).
+ */
+static FILE *open_compressed(FILE *fp, uint8_t *probe, size_t *probe_len, const char *name)
+{
+	int type = decomp_detect(probe, *probe_len);
+	if(type == DECOMP_NONE)
+		return fp;
+
+	FILE *dfp = decomp_fopen(fp, type);
+	if(!dfp)
+	{
+		// zlib detection is only heuristic, so it may be a raw file
+		if(type == DECOMP_ZLIB)
+			return fp;
+
+		printf("MULTIBOOT: unable to decompress %s\n", name);
+		fclose(fp);
+		return NULL;
+	}
+
+	printf("MULTIBOOT: %s is %s compressed, %i bytes uncompressed\n", name,
+			decomp_name(type), dfp->len);
+	*probe_len = fread(probe, 1, *probe_len, dfp);
+	return dfp;
+}
+#endif
+
+// Reserve memory for each PT_LOAD segment and describe it as a region to be
+//  loaded by elf32_load_regions().  Returns the number of regions or -1.
+static int elf_segment_regions(Elf32_Ehdr *ehdr, uint8_t *ph_buf, struct elf32_region *regions)
+{
+	int count = 0;
+
+	for(unsigned int i = 0; i < ehdr->e_phnum; i++)
+	{
+		Elf32_Phdr *phdr = (Elf32_Phdr *)&ph_buf[i * ehdr->e_phentsize];
+
+		if(phdr->p_type != PT_LOAD)
+			continue;
+
+		uint32_t start = (uint32_t)phdr->p_paddr;
+		uint32_t length = (uint32_t)phdr->p_memsz;
+
+		// Check we can load to this address
+		if(!chunk_get_chunk(start, length))
+		{
+			printf("ELF: unable to allocate a chunk between 0x%08x and "
+					"0x%08x\n", start, start + length);
+			return -1;
+		}
+
+		struct elf32_region *r = &regions[count++];
+		r->offset = phdr->p_offset;
+		r->filesz = phdr->p_filesz;
+		r->memsz = phdr->p_memsz;
+		r->dest = (void *)(uintptr_t)start;
+	}
+
+	return count;
+}
+
 int method_entry_addr(char *args)
 {
 	// strtol requires checking errno for success as the returned value
@@ -857,6 +1382,29 @@ int method_binary_load_addr(char *args)
 	}
 }
 
+#ifdef ENABLE_SERIAL
+int method_baud(char *args)
+{
+	errno = 0;
+	char *endptr;
+	long val = strtol(args, &endptr, 0);
+	if((errno != 0) || (*args == '\0') || (*endptr != '\0') || (val <= 0))
+	{
+		printf("BAUD: %s is not a valid baud rate\n", args);
+		return -1;
+	}
+
+#ifdef ENABLE_RASPBOOTIN
+	// Take a raspbootin server along to the new rate if it can follow
+	int ret = raspbootin_set_baud((uint32_t)val);
+	if(ret != UNSUPPORTED_CMD)
+		return (ret == 0) ? 0 : -1;
+#endif
+
+	return uart_set_baud((uint32_t)val);
+}
+#endif
+
 void mem_cb(uint32_t start, uint32_t size)
 {
 	uint32_t end = start + size;
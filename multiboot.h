@@ -57,9 +57,79 @@ struct dirent {
 	uint8_t is_dir;
 	void *opaque;
 	struct fs *fs;
+	uint32_t mtime;		// filesystem specific format, 0 if not known
 };
 
-#define MB_ARM_VERSION		2
+#define MB_ARM_VERSION		3
+
+// Boot timeline, see MULTIBOOT-ARM
+#define BOOT_TIMELINE_MAGIC		0x4c544252		// 'RBTL'
+#define BOOT_TIMELINE_VERSION	1
+
+#define BOOT_TIMELINE_PHASE		0
+#define BOOT_TIMELINE_FILE		1
+
+struct boot_timeline_entry
+{
+	uint32_t start_us;			// system timer (TIMER_CLO) value
+	uint32_t duration_us;
+	uint32_t type;				// BOOT_TIMELINE_PHASE or BOOT_TIMELINE_FILE
+	uint32_t bytes;				// file loads only
+	uint32_t io_count;			// file loads only: block device requests
+	char name[28];
+};
+
+struct boot_timeline
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_size;
+	uint32_t count;
+	uint32_t handover_us;		// TIMER_CLO just before the kernel is entered
+	uint32_t reserved[3];
+	struct boot_timeline_entry entries[];
+};
+
+// Boot log, see MULTIBOOT-ARM
+#define BOOT_LOG_MAGIC			0x474c4252		// 'RBLG'
+#define BOOT_LOG_VERSION		1
+
+#define BOOT_LOG_ERR			3			// written to stderr
+#define BOOT_LOG_INFO			6			// written to stdout
+#define BOOT_LOG_LEVEL_MASK		0x07
+#define BOOT_LOG_PAD			0x40		// filler up to the end of the ring
+#define BOOT_LOG_CONTINUED		0x80		// line continues in the next record
+
+struct boot_log_record
+{
+	uint32_t timestamp_us;		// TIMER_CLO when the line was started
+	uint16_t text_len;			// subsystem and message
+	uint8_t level;				// BOOT_LOG_* level and flags
+	uint8_t subsys_len;
+	char text[];				// subsystem then message, no terminators
+};
+
+// Records are padded to a multiple of 8 bytes
+#define BOOT_LOG_RECORD_LENGTH(text_len) \
+	((sizeof(struct boot_log_record) + (text_len) + 7) & ~7)
+
+struct boot_log
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;				// of data[], a power of two
+	uint32_t head;				// end of the newest record
+	uint32_t tail;				// start of the oldest record
+	uint32_t dropped;			// records lost before reaching the log file
+	uint32_t reserved[2];
+	uint8_t data[];				// head and tail are taken modulo size
+};
+
+struct module;
+
+// See block.h
+struct block_device;
+struct block_request;
 
 struct multiboot_arm_functions
 {
@@ -109,6 +179,32 @@ struct multiboot_arm_functions
 	void (*output_disable_log)();
 	int (*register_log_file)(FILE *fp, size_t buffer_size);
 	FILE *(*get_log_file)();
+
+	// Boot timeline (version 3)
+	const struct boot_timeline *(*get_boot_timeline)();
+
+	// Read modules, including those declared with lazy_module (version 3)
+	size_t (*module_read)(const struct module *mod, void *ptr, size_t offset, size_t length);
+
+	// Block device functions (version 3)
+	char **(*get_device_list)();
+	struct block_device *(*get_block_device)(const char *name);
+	size_t (*block_read)(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t starting_block);
+	size_t (*block_write)(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t starting_block);
+	int (*block_submit)(struct block_device *dev, struct block_request *req);
+	int (*block_poll)(struct block_device *dev);
+	int (*block_wait)(struct block_device *dev, struct block_request *req);
+	int (*fextent)(FILE *fp, long offset, size_t max_length, struct block_device **dev,
+			uint32_t *block_num, size_t *length);
+
+	// Bulk custom output (version 3)
+	int (*register_custom_output_write_function)(int (*write_function)(const char *buf, size_t len));
+
+	// Boot log (version 3)
+	const struct boot_log *(*get_boot_log)();
+
+	// Report a successful boot (version 3)
+	void (*confirm_boot)();
 };
 
 #endif // __ARMEL__
@@ -29,15 +29,26 @@
  * backward/forwards etc
  * The first three bytes of the filesystem are the UTF-8 byte order mark
  * (0xef, 0xbb, 0xbf) which should be ignored by any program which reads the
- * filesystem.  If we read this on fopen, we search for an EOF marker to set the
+ * filesystem.  If we read this on fopen, we find the EOF marker to set the
  * current position (if mode & APPEND)
+ *
+ * So that appending doesn't need to search the partition, the length of the
+ * file is also kept in a trailer in one of the last two blocks of the
+ * partition.  Each write which changes the length updates the other one,
+ * with a higher sequence number, so a write torn by a power cut leaves the
+ * previous one valid.  The data is written before the trailer, so a valid
+ * trailer never points past the data.  Without a valid trailer we fall back to
+ * a binary search for the boundary between written and blank blocks, and
+ * only if that fails to a linear search for the EOF marker.
  */
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include "vfs.h"
+#include "crc32.h"
 
 
 // Define to be the EOF marker to use
@@ -49,6 +60,22 @@
 #define UTF_BOM_2		0xbb
 #define UTF_BOM_3		0xbf
 
+#define NOFS_TRAILER_MAGIC		0x53464f4e		// 'NOFS'
+#define NOFS_TRAILER_VERSION	1
+#define NOFS_TRAILER_BLOCKS		2
+
+// Number of blocks read at a time by the linear search
+#define NOFS_SCAN_BLOCKS		16
+
+struct nofs_trailer
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seq;
+	uint32_t len;				// file length including the BOM
+	uint32_t crc;				// of the above
+};
+
 static uint8_t eof_mark[] = EOF_MARK;
 static char nofs_name[] = "nofs";
 
@@ -59,6 +86,9 @@ static char nofs_debug_startup[] = "NOFS started up in debug mode\n";
 struct nofs_fs
 {
 	struct fs b;
+	int trailer_valid;
+	uint32_t trailer_seq;		// of the newest valid trailer
+	uint32_t trailer_len;		// length it records
 };
 
 static struct dirent *nofs_read_directory(struct fs *fs, char **name);
@@ -69,6 +99,9 @@ static FILE *nofs_fopen(struct fs *fs, struct dirent *path, const char *mode);
 static long nofs_fsize(FILE *fp);
 static int nofs_fseek(FILE *stream, long offset, int whence);
 static long nofs_ftell(FILE *fp);
+static int nofs_fmap(FILE *fp, long offset, size_t max_length, uint32_t *block_num, size_t *length);
+static int nofs_read_trailer(struct fs *fs);
+static int nofs_write_trailer(struct fs *fs, uint32_t len);
 
 int nofs_init(struct block_device *parent, struct fs **fs)
 {
@@ -90,6 +123,7 @@ int nofs_init(struct block_device *parent, struct fs **fs)
 	nofs->b.fseek = nofs_fseek;
 	nofs->b.fsize = nofs_fsize;
 	nofs->b.ftell = nofs_ftell;
+	nofs->b.fmap = nofs_fmap;
 	nofs->b.read_directory = nofs_read_directory;
 	nofs->b.block_size = parent->block_size;
 
@@ -97,6 +131,9 @@ int nofs_init(struct block_device *parent, struct fs **fs)
 
 	printf("NOFS: found a nofs partition on %s\n", parent->device_name);
 
+	// Only this driver writes the trailer, so it need only be read once
+	nofs_read_trailer(*fs);
+
 #ifdef NOFS_DEBUG
 	FILE *nfs_f = nofs_fopen(*fs, NULL, "a+");
 	if(nfs_f == NULL)
@@ -106,6 +143,193 @@ int nofs_init(struct block_device *parent, struct fs **fs)
 	return 0;
 }
 
+static int nofs_has_trailer(struct fs *fs)
+{
+	return fs->parent->num_blocks > NOFS_TRAILER_BLOCKS;
+}
+
+// Number of blocks available to the file
+static size_t nofs_data_blocks(struct fs *fs)
+{
+	if(nofs_has_trailer(fs))
+		return fs->parent->num_blocks - NOFS_TRAILER_BLOCKS;
+	return fs->parent->num_blocks;
+}
+
+static uint32_t nofs_trailer_crc(const struct nofs_trailer *t)
+{
+	return crc32(t, offsetof(struct nofs_trailer, crc));
+}
+
+// Read both trailers in one request and use the newest valid one
+static int nofs_read_trailer(struct fs *fs)
+{
+	struct nofs_fs *nofs = (struct nofs_fs *)fs;
+	if(!nofs_has_trailer(fs))
+		return -1;
+
+	size_t bs = fs->parent->block_size;
+	uint8_t *buf = (uint8_t *)malloc(NOFS_TRAILER_BLOCKS * bs);
+	if(buf == NULL)
+		return -1;
+
+	int ret = -1;
+	if(block_read(fs->parent, buf, NOFS_TRAILER_BLOCKS * bs,
+			nofs_data_blocks(fs)) == NOFS_TRAILER_BLOCKS * bs)
+	{
+		for(int i = 0; i < NOFS_TRAILER_BLOCKS; i++)
+		{
+			struct nofs_trailer t;
+			memcpy(&t, &buf[i * bs], sizeof(struct nofs_trailer));
+
+			if((t.magic != NOFS_TRAILER_MAGIC) ||
+					(t.version != NOFS_TRAILER_VERSION) ||
+					(t.crc != nofs_trailer_crc(&t)) || (t.len < 3) ||
+					(t.len > nofs_data_blocks(fs) * bs - sizeof(eof_mark)))
+				continue;
+
+			if((ret != 0) || ((int32_t)(t.seq - nofs->trailer_seq) > 0))
+			{
+				nofs->trailer_seq = t.seq;
+				nofs->trailer_len = t.len;
+				ret = 0;
+			}
+		}
+	}
+	free(buf);
+
+	nofs->trailer_valid = (ret == 0);
+	return ret;
+}
+
+static int nofs_write_trailer(struct fs *fs, uint32_t len)
+{
+	struct nofs_fs *nofs = (struct nofs_fs *)fs;
+	if(!nofs_has_trailer(fs) || (nofs->trailer_valid && (len == nofs->trailer_len)))
+		return 0;
+
+	size_t bs = fs->parent->block_size;
+	uint8_t *buf = (uint8_t *)malloc(bs);
+	if(buf == NULL)
+		return -1;
+	memset(buf, 0, bs);
+
+	struct nofs_trailer t;
+	t.magic = NOFS_TRAILER_MAGIC;
+	t.version = NOFS_TRAILER_VERSION;
+	t.seq = nofs->trailer_seq + 1;
+	t.len = len;
+	t.crc = nofs_trailer_crc(&t);
+	memcpy(buf, &t, sizeof(struct nofs_trailer));
+
+	// Alternate between the two blocks
+	size_t written = block_write(fs->parent, buf, bs,
+			nofs_data_blocks(fs) + (t.seq % NOFS_TRAILER_BLOCKS));
+	free(buf);
+	if(written != bs)
+		return -1;
+
+	nofs->trailer_valid = 1;
+	nofs->trailer_seq = t.seq;
+	nofs->trailer_len = len;
+	return 0;
+}
+
+/* Find the first EOF marker in 'count' blocks starting at 'block', reading
+ *  them in one request */
+static int nofs_find_eof_mark(struct fs *fs, uint8_t *buf, uint32_t block,
+		size_t count, long *pos)
+{
+	size_t bs = fs->parent->block_size;
+	size_t bytes_read = block_read(fs->parent, buf, count * bs, block);
+
+	for(size_t i = 0; i + sizeof(eof_mark) <= bytes_read; i++)
+	{
+		if((buf[i] == eof_mark[0]) &&
+				!memcmp(&buf[i], eof_mark, sizeof(eof_mark)))
+		{
+			*pos = (long)(block * bs + i);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+// Check for the EOF marker at pos, normally reading a single block
+static int nofs_eof_mark_at(struct fs *fs, long pos)
+{
+	size_t bs = fs->parent->block_size;
+	uint32_t block = (uint32_t)pos / bs;
+	size_t offset = (uint32_t)pos % bs;
+	size_t count = (offset + sizeof(eof_mark) + bs - 1) / bs;
+	if(block + count > nofs_data_blocks(fs))
+		return 0;
+
+	uint8_t *buf = (uint8_t *)malloc(count * bs);
+	if(buf == NULL)
+		return 0;
+	int ret = (block_read(fs->parent, buf, count * bs, block) == count * bs) &&
+		!memcmp(&buf[offset], eof_mark, sizeof(eof_mark));
+	free(buf);
+	return ret;
+}
+
+// A block of the partition which has never been written to
+static int nofs_block_is_blank(struct fs *fs, uint8_t *buf, uint32_t block)
+{
+	size_t bs = fs->parent->block_size;
+	if(block_read(fs->parent, buf, bs, block) != bs)
+		return 0;
+	if((buf[0] != 0x00) && (buf[0] != 0xff))
+		return 0;
+	for(size_t i = 1; i < bs; i++)
+	{
+		if(buf[i] != buf[0])
+			return 0;
+	}
+	return 1;
+}
+
+// Find the end of the file without a trailer
+static int nofs_search_eof(struct fs *fs, long *pos)
+{
+	size_t bs = fs->parent->block_size;
+	size_t data_blocks = nofs_data_blocks(fs);
+	uint8_t *buf = (uint8_t *)malloc(NOFS_SCAN_BLOCKS * bs);
+	if(buf == NULL)
+		return -1;
+
+	/* The file is written from the start of the partition, so the blocks
+	 *  which have been written normally form a prefix of it.  Binary search
+	 *  for the last one (block 0 holds the BOM), then look for the marker
+	 *  there, allowing for it to have started in the block before. */
+	uint32_t lo = 0, hi = data_blocks;
+	while(hi - lo > 1)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		if(nofs_block_is_blank(fs, buf, mid))
+			hi = mid;
+		else
+			lo = mid;
+	}
+	uint32_t first = (lo > 0) ? lo - 1 : 0;
+	int ret = nofs_find_eof_mark(fs, buf, first, lo - first + 1, pos);
+
+	// Otherwise search the whole partition, overlapping each read by a block
+	//  in case the marker crosses a block boundary
+	for(uint32_t block_no = 0; (ret != 0) && (block_no < data_blocks);
+			block_no += NOFS_SCAN_BLOCKS - 1)
+	{
+		size_t count = NOFS_SCAN_BLOCKS;
+		if(block_no + count > data_blocks)
+			count = data_blocks - block_no;
+		ret = nofs_find_eof_mark(fs, buf, block_no, count, pos);
+	}
+
+	free(buf);
+	return ret;
+}
+
 FILE *nofs_fopen(struct fs *fs, struct dirent *path, const char *mode)
 {
 	struct vfs_file *f = (struct vfs_file *)malloc(sizeof(struct vfs_file));
@@ -151,39 +375,30 @@ FILE *nofs_fopen(struct fs *fs, struct dirent *path, const char *mode)
 			m, fs->parent->num_blocks);
 #endif
 		free(block_0);
-		// If the mode argument includes an append, we have to search the
-		//  file looking for an EOF marker.  We can only do this if the
-		//  underlying block device has a valid length
-		if((m & VFS_MODE_APPEND) && fs->parent->num_blocks)
+		// If the mode argument includes an append, we need the position of
+		//  the EOF marker: from the trailer if it is valid and the marker is
+		//  where it says (it may be stale if something else has written to
+		//  the partition), otherwise we have to search for it.  We can only
+		//  do this if the underlying block device has a valid length
+		struct nofs_fs *nofs = (struct nofs_fs *)fs;
+		if((m & VFS_MODE_APPEND) && nofs->trailer_valid)
+		{
+			if(nofs_eof_mark_at(fs, (long)nofs->trailer_len))
+				start_pos = (long)nofs->trailer_len;
+			else
+				nofs->trailer_valid = 0;
+		}
+		if((m & VFS_MODE_APPEND) && !nofs->trailer_valid &&
+				fs->parent->num_blocks)
 		{
 #ifdef NOFS_DEBUG
 			printf("NOFS: searching for an EOF marker: ");
 #endif
-			int found = 0;
-			size_t block_no = 0;
-			uint8_t *buf = (uint8_t *)malloc(fs->parent->block_size);
-			if(buf == NULL)
-				return NULL;
-		
-			while((found == 0) && (block_no < fs->parent->num_blocks))
-			{
-				bytes_read = fs->parent->read(fs->parent, buf,
-					fs->parent->block_size, block_no);
-
-				if(bytes_read == 0)
-					break;
-
-				for(size_t i = 0; i < bytes_read; i++)
-				{
-					if(buf[i] == EOF)
-					{
-						start_pos = block_no * fs->parent->block_size +
-							i;
-						found = 1;
-						break;
-					}
-				}
-			}
+			int found = (nofs_search_eof(fs, &start_pos) == 0);
+			if(found)
+				nofs_write_trailer(fs, (uint32_t)start_pos);
+			else
+				start_pos = 3;
 
 #ifdef NOFS_DEBUG
 			if(found)
@@ -191,8 +406,6 @@ FILE *nofs_fopen(struct fs *fs, struct dirent *path, const char *mode)
 			else
 				printf("not found\n");
 #endif
-
-			free(buf);
 		}
 	}
 	else
@@ -223,6 +436,9 @@ FILE *nofs_fopen(struct fs *fs, struct dirent *path, const char *mode)
 #endif
 			return NULL;
 		}
+
+		// Don't let a trailer left by an earlier file point past the new one
+		nofs_write_trailer(fs, (uint32_t)start_pos);
 	}
 
 	// Now fill in the FILE structure
@@ -240,7 +456,7 @@ FILE *nofs_fopen(struct fs *fs, struct dirent *path, const char *mode)
 
 static uint32_t nofs_get_next_bdev_block_num(uint32_t f_block_idx, FILE *s, void *opaque, int add_blocks)
 {
-	if((s->fs->parent->block_size) && (f_block_idx >= s->fs->parent->block_size))
+	if((s->fs->parent->num_blocks) && (f_block_idx >= nofs_data_blocks(s->fs)))
 	{
 		errno = ENOSPC;
 		return 0xffffffff;
@@ -257,6 +473,12 @@ size_t nofs_fread(struct fs *fs, void *ptr, size_t byte_size, FILE *stream)
 	return fs_fread(nofs_get_next_bdev_block_num, fs, ptr, byte_size, stream, NULL);
 }
 
+int nofs_fmap(FILE *fp, long offset, size_t max_length, uint32_t *block_num, size_t *length)
+{
+	return fs_fmap(nofs_get_next_bdev_block_num, fp->fs, fp, offset, max_length,
+		block_num, length, NULL);
+}
+
 size_t nofs_fwrite(struct fs *fs, void *ptr, size_t byte_size, FILE *stream)
 {
 	long old_len = stream->len;
@@ -269,6 +491,9 @@ size_t nofs_fwrite(struct fs *fs, void *ptr, size_t byte_size, FILE *stream)
 		fs_fwrite(nofs_get_next_bdev_block_num, fs, eof_mark, sizeof(eof_mark), stream, NULL);
 		stream->pos = new_pos;
 		stream->len = new_pos;
+
+		// Record the new length once the data is on the device
+		nofs_write_trailer(fs, (uint32_t)new_pos);
 	}
 	return ret;
 }
@@ -19,13 +19,16 @@
  * THE SOFTWARE.
  */
 
+#include <stdio.h>
 #include "output.h"
 #include "uart.h"
 #include "console.h"
 #include "log.h"
+#include "multiboot.h"
 
 rpi_boot_output_state ostate;
 int (*custom_putc)(int c) = NULL;
+int (*custom_write)(const char *buf, size_t len) = NULL;
 
 rpi_boot_output_state output_get_state()
 {
@@ -86,30 +89,100 @@ void output_enable_log()
 void output_init()
 {
     ostate = 0;
+#ifdef ENABLE_CONSOLE_LOGFILE
+    log_init();
+#endif
 }
 
-int split_putc(int c)
+/* Pass a run of characters to each enabled output in one call, so the
+ *  per-call costs of each (FIFO polling, the log line assembly etc) are
+ *  paid once per buffer rather than once per character */
+static int output_write(const char *buf, size_t len, int level)
 {
     int ret = 0;
+    if(len == 0)
+        return 0;
 #ifdef ENABLE_SERIAL
     if(ostate & RPIBOOT_OUTPUT_UART)
-        ret = uart_putc(c);
+        ret = uart_write(buf, len);
 #endif
 #ifdef ENABLE_FRAMEBUFFER
     if(ostate & RPIBOOT_OUTPUT_FB)
-        ret = console_putc(c);
+        ret = console_write(buf, len);
 #endif
 #ifdef ENABLE_CONSOLE_LOGFILE
 	if(ostate & RPIBOOT_OUTPUT_LOG)
-		ret = log_putc(c);
+		ret = log_write_level(buf, len, level);
+#else
+	(void)level;
 #endif
-	if((ostate & RPIBOOT_OUTPUT_CUSTOM) && custom_putc)
-		custom_putc(c);
+	if(ostate & RPIBOOT_OUTPUT_CUSTOM)
+	{
+		if(custom_write)
+			custom_write(buf, len);
+		else if(custom_putc)
+		{
+			for(size_t i = 0; i < len; i++)
+				custom_putc(buf[i]);
+		}
+	}
     return ret;
 }
 
+int split_write(const char *buf, size_t len)
+{
+    return output_write(buf, len, BOOT_LOG_INFO);
+}
+
+// As split_write, but the log records it as an error
+int split_write_err(const char *buf, size_t len)
+{
+    return output_write(buf, len, BOOT_LOG_ERR);
+}
+
+/* Make sure everything written so far is visible, or has been sent (which
+ *  waits for the uart to catch up) */
+void output_flush()
+{
+#ifdef ENABLE_SERIAL
+    uart_flush();
+#endif
+#ifdef ENABLE_FRAMEBUFFER
+    if(ostate & RPIBOOT_OUTPUT_FB)
+        console_flush();
+#endif
+}
+
+/* Called just before the kernel is entered: flush everything and leave the
+ *  outputs in the state the kernel expects to find them */
+void output_handover()
+{
+    output_flush();
+#ifdef ENABLE_SERIAL
+    uart_set_buffered(0);
+#endif
+#ifdef ENABLE_FRAMEBUFFER
+    console_reset_scroll();
+    console_set_immediate();
+#endif
+}
+
+int split_putc(int c)
+{
+    char ch = (char)c;
+    if(split_write(&ch, 1) == EOF)
+        return EOF;
+    return c;
+}
+
 int register_custom_output_function(int (*putc_function)(int c))
 {
 	custom_putc = putc_function;
 	return 0;
 }
+
+int register_custom_output_write_function(int (*write_function)(const char *buf, size_t len))
+{
+	custom_write = write_function;
+	return 0;
+}
@@ -23,6 +23,7 @@
 #define OUTPUT_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 typedef uint32_t rpi_boot_output_state;
 
@@ -39,7 +40,12 @@ void output_enable_custom();
 void output_disable_custom();
 void output_init();
 int split_putc(int c);
+int split_write(const char *buf, size_t len);
+int split_write_err(const char *buf, size_t len);
+void output_flush();
+void output_handover();
 int register_custom_output_function(int (*putc_function)(int c));
+int register_custom_output_write_function(int (*write_function)(const char *buf, size_t len));
 #endif
 
 #define RPIBOOT_OUTPUT_FB      (1 << 0)
@@ -0,0 +1,205 @@
+/* Copyright (C) 2016 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Records are stored back to back from the base of the area and padded to a multiple
+ * of 4 bytes.  The list is terminated by the first record without a valid
+ * magic number or CRC.  Removed records keep their space (with a tag of 0)
+ * until persist_init() compacts the area on the next boot.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "crc32.h"
+#include "persist.h"
+
+#ifdef DEBUG2
+#define PERSIST_DEBUG
+#endif
+
+#define PERSIST_MAGIC		PERSIST_TAG('P', 'R', 'S', 'T')
+#define PERSIST_TAG_FREE	0
+
+struct persist_rec
+{
+	uint32_t magic;
+	uint32_t tag;
+	uint32_t length;
+	uint32_t crc;
+	uint8_t data[];
+};
+
+static int persist_available = 0;
+static uintptr_t persist_base = 0;
+static struct persist_rec *persist_end = NULL;
+
+#define PERSIST_LIMIT		(persist_base + PERSIST_LENGTH)
+
+static size_t rec_size(size_t length)
+{
+	return sizeof(struct persist_rec) + ((length + 3) & ~3);
+}
+
+static struct persist_rec *rec_next(struct persist_rec *r)
+{
+	return (struct persist_rec *)((uintptr_t)r + rec_size(r->length));
+}
+
+// Return 1 if r points to a complete record with a correct CRC
+static int rec_valid(struct persist_rec *r)
+{
+	uintptr_t addr = (uintptr_t)r;
+	if(addr + sizeof(struct persist_rec) > PERSIST_LIMIT)
+		return 0;
+	if(r->magic != PERSIST_MAGIC)
+		return 0;
+	if(r->length > PERSIST_LIMIT - addr - sizeof(struct persist_rec))
+		return 0;
+	if(crc32(r->data, r->length) != r->crc)
+		return 0;
+	return 1;
+}
+
+static void mark_end(void)
+{
+	if((uintptr_t)persist_end + sizeof(uint32_t) <= PERSIST_LIMIT)
+		persist_end->magic = 0;
+}
+
+static struct persist_rec *rec_find(uint32_t tag)
+{
+	if(!persist_available || (tag == PERSIST_TAG_FREE))
+		return NULL;
+
+	struct persist_rec *r = (struct persist_rec *)persist_base;
+	while(r < persist_end)
+	{
+		if(r->tag == tag)
+			return r;
+		r = rec_next(r);
+	}
+	return NULL;
+}
+
+// Discard any invalid or removed records left over from the previous boot.
+//  The caller must have reserved PERSIST_LENGTH bytes at base so that nothing
+//  else is loaded there, and must pick the same base on every boot.
+int persist_init(uint32_t base)
+{
+	persist_base = base;
+	struct persist_rec *r = (struct persist_rec *)persist_base;
+	uint8_t *out = (uint8_t *)persist_base;
+	int kept = 0;
+	while(rec_valid(r))
+	{
+		struct persist_rec *next = rec_next(r);
+		if(r->tag != PERSIST_TAG_FREE)
+		{
+			size_t size = rec_size(r->length);
+			if((uint8_t *)r != out)
+				memmove(out, r, size);
+			out += size;
+			kept++;
+		}
+		r = next;
+	}
+
+	persist_end = (struct persist_rec *)out;
+	mark_end();
+	persist_available = 1;
+
+#ifdef PERSIST_DEBUG
+	printf("PERSIST: %i record(s) preserved from previous boot\n", kept);
+#else
+	(void)kept;
+#endif
+	return 0;
+}
+
+// Return the data of the record with the given tag, or NULL if there is none
+void *persist_get(uint32_t tag, size_t *length)
+{
+	struct persist_rec *r = rec_find(tag);
+	if(r == NULL)
+		return NULL;
+	if(length)
+		*length = r->length;
+	return r->data;
+}
+
+// Create (or replace) a zero-filled record of the given length and return a
+//  pointer to its data.  Call persist_commit() once the data is filled in.
+void *persist_alloc(uint32_t tag, size_t length)
+{
+	if(!persist_available || (tag == PERSIST_TAG_FREE))
+		return NULL;
+
+	persist_remove(tag);
+
+	if((uintptr_t)persist_end + rec_size(length) > PERSIST_LIMIT)
+	{
+#ifdef PERSIST_DEBUG
+		printf("PERSIST: no space for record %08x (%i bytes)\n", tag, length);
+#endif
+		return NULL;
+	}
+
+	struct persist_rec *r = persist_end;
+	r->tag = tag;
+	r->length = length;
+	memset(r->data, 0, length);
+	r->crc = crc32(r->data, length);
+	r->magic = PERSIST_MAGIC;
+
+	persist_end = rec_next(r);
+	mark_end();
+
+	return r->data;
+}
+
+// Update the CRC of a record after its data has been changed
+void persist_commit(void *data)
+{
+	if(data == NULL)
+		return;
+
+	struct persist_rec *r = (struct persist_rec *)((uintptr_t)data -
+		sizeof(struct persist_rec));
+	r->crc = crc32(r->data, r->length);
+}
+
+int persist_set(uint32_t tag, const void *data, size_t length)
+{
+	void *d = persist_alloc(tag, length);
+	if(d == NULL)
+		return -1;
+	memcpy(d, data, length);
+	persist_commit(d);
+	return 0;
+}
+
+void persist_remove(uint32_t tag)
+{
+	struct persist_rec *r = rec_find(tag);
+	if(r)
+		r->tag = PERSIST_TAG_FREE;
+}
+
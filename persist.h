@@ -0,0 +1,46 @@
+/* Copyright (C) 2016 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* A small store of tagged records in a reserved area of memory which is
+ * preserved across warm reboots (e.g. those triggered by the watchdog).
+ *
+ * Each record is protected by a CRC so anything left over from a cold boot,
+ * or overwritten by the previously booted kernel, is simply discarded.
+ */
+
+#ifndef PERSIST_H
+#define PERSIST_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PERSIST_TAG(a, b, c, d)		((uint32_t)(a) | ((uint32_t)(b) << 8) | \
+					((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+int persist_init(uint32_t base);
+void *persist_get(uint32_t tag, size_t *length);
+void *persist_alloc(uint32_t tag, size_t length);
+void persist_commit(void *data);
+int persist_set(uint32_t tag, const void *data, size_t length);
+void persist_remove(uint32_t tag);
+
+#endif
+
@@ -33,27 +33,17 @@
  *	@(#)subr_prf.c	8.3 (Berkeley) 1/21/94
  */
 
-#define putchar putc
-void putc(int c, void *stream);
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
 
-typedef unsigned long size_t;
 typedef long ssize_t;
-#ifdef __64BIT__
-typedef unsigned long long uintmax_t;
-typedef long long intmax_t;
-#else
-typedef unsigned int uintmax_t;
-typedef int intmax_t;
-#endif
 typedef unsigned char u_char;
 typedef unsigned int u_int;
 typedef unsigned long u_long;
 typedef unsigned short u_short;
 typedef unsigned long long u_quad_t;
 typedef long long quad_t;
-typedef unsigned long uintptr_t;
-typedef long ptrdiff_t;
-#define NULL ((void*)0)
 #define NBBY    8               /* number of bits in a byte */
 char const hex2ascii_data[] = "0123456789abcdefghijklmnopqrstuvwxyz";
 #define hex2ascii(hex)  (hex2ascii_data[hex])
@@ -436,24 +426,60 @@ number:
 #undef PCHAR
 }
 
-void
+/* printf formats into a small buffer which is passed on to the outputs a
+ * line (or a buffer full) at a time, rather than one character at a time.
+ */
+#define PRINTF_BUF_SIZE	128
+
+struct printf_buf {
+	int len;
+	char buf[PRINTF_BUF_SIZE];
+};
+
+static void
+printf_flush(struct printf_buf *pb)
+{
+	if (pb->len) {
+		stdio_write(pb->buf, (size_t)pb->len, stdout);
+		pb->len = 0;
+	}
+}
+
+static void
+printf_putc(int c, void *arg)
+{
+	struct printf_buf *pb = (struct printf_buf *)arg;
+
+	pb->buf[pb->len++] = (char)c;
+	if (c == '\n' || pb->len == PRINTF_BUF_SIZE)
+		printf_flush(pb);
+}
+
+int
 printf(const char *fmt, ...)
 {
 	/* http://www.pagetable.com/?p=298 */
 	va_list ap;
+	struct printf_buf pb;
+	int ret;
 
+	pb.len = 0;
 	va_start(ap, fmt);
-	kvprintf(fmt, putchar, (void*)1, 10, ap);
+	ret = kvprintf(fmt, printf_putc, &pb, 10, ap);
 	va_end(ap);
+	printf_flush(&pb);
+	return ret;
 }
 
 /* Thanks to James Cone (https://github.com/JamesC1) for this */
-void
+int
 sprintf(char *buffer, const char *fmt, ...)
 {
 	va_list ap;
+	int ret;
 
 	va_start(ap, fmt);
-	kvprintf(fmt, NULL, (void *)buffer, 10, ap);
+	ret = kvprintf(fmt, NULL, (void *)buffer, 10, ap);
 	va_end(ap);
+	return ret;
 }
@@ -52,7 +52,7 @@
 
 #define READ_BUF_LEN                0x1000
 
-#define SERVER_CAPABILITIES         0x1f
+#define SERVER_CAPABILITIES         0x3f
 
 #ifdef _WIN32
 typedef HANDLE port_addr;
@@ -291,6 +291,110 @@ static port_addr open_serial(const char *dev)
     }
 }
 
+#ifndef _WIN32
+static speed_t baud_to_speed(uint32_t baud)
+{
+    switch(baud)
+    {
+        case 115200:
+            return B115200;
+        case 230400:
+            return B230400;
+#ifdef B460800
+        case 460800:
+            return B460800;
+#endif
+#ifdef B921600
+        case 921600:
+            return B921600;
+#endif
+#ifdef B1000000
+        case 1000000:
+            return B1000000;
+#endif
+#ifdef B1500000
+        case 1500000:
+            return B1500000;
+#endif
+#ifdef B2000000
+        case 2000000:
+            return B2000000;
+#endif
+#ifdef B3000000
+        case 3000000:
+            return B3000000;
+#endif
+#ifdef B4000000
+        case 4000000:
+            return B4000000;
+#endif
+        default:
+            return B0;
+    }
+}
+#endif
+
+static int baud_supported(port_addr fd, uint32_t baud)
+{
+#ifdef _WIN32
+    (void)fd;
+    return baud != 0;
+#else
+    // Anything goes over a socket or pipe
+    if(!isatty(fd))
+        return 1;
+    return baud_to_speed(baud) != B0;
+#endif
+}
+
+static int set_serial_baud(port_addr fd, uint32_t baud)
+{
+#ifdef _WIN32
+    // Let the response go out at the old rate first
+    FlushFileBuffers(fd);
+
+    DCB config;
+    if(GetCommState(fd, &config) == 0)
+    {
+        fprintf(stderr, "Error calling GetCommState, error %08x\n", GetLastError());
+        return -1;
+    }
+    config.BaudRate = baud;
+    if(SetCommState(fd, &config) == 0)
+    {
+        fprintf(stderr, "Error calling SetCommState, error %08x\n", GetLastError());
+        return -1;
+    }
+    return 0;
+#else
+    if(!isatty(fd))
+        return 0;
+
+    // Let the response go out at the old rate first
+    tcdrain(fd);
+
+    struct termios termios;
+    if(tcgetattr(fd, &termios) == -1)
+    {
+        fprintf(stderr, "Failed to get attributes\n");
+        return -1;
+    }
+    speed_t speed = baud_to_speed(baud);
+    if((cfsetispeed(&termios, speed) < 0) ||
+    (cfsetospeed(&termios, speed) < 0))
+    {
+        fprintf(stderr, "Failed to set baud rate\n");
+        return -1;
+    }
+    if(tcsetattr(fd, TCSANOW, &termios) == -1)
+    {
+        fprintf(stderr, "Failed to write attributes\n");
+        return -1;
+    }
+    return 0;
+#endif
+}
+
 int main(int argc, char *argv[])
 {
     (void)argc;
@@ -540,6 +644,32 @@ static int do_cmd(int cmd, port_addr fd)
 
             return 0;
         }
+
+        case 5:
+        {
+            // Change baud rate
+            uint32_t baud;
+            serial_read(fd, &baud, 4);
+            uint32_t eccrc = crc32(&baud, 4);
+
+            // Read the command crc
+            uint32_t ccrc;
+            serial_read(fd, &ccrc, 4);
+            if(ccrc != eccrc)
+                return send_error_msg(fd, CRC_ERROR);
+
+            if(!baud_supported(fd, baud))
+                return send_error_msg(fd, INVALID_BAUD);
+
+            // Reply at the old rate, then switch
+            send_error_msg(fd, SUCCESS);
+            if(set_serial_baud(fd, baud) != 0)
+                return -1;
+
+            fprintf(stderr, "Switched to %u baud\n", baud);
+
+            return 0;
+        }
     }
     (void)fd;
     return 0;
@@ -68,6 +68,7 @@
         -1                  Path not found
         -2                  EOF
         -3                  CRC error in request
+        -9                  Baud rate not supported
 
     File/directory properties:
 
@@ -125,6 +126,15 @@
                             <options> is <string message><crc>
                             Returns:
                                 <magic><msg_length><lsb32 error_code><crc>
+
+    5       RBTIN_V2_SPEC   Change the baud rate
+                            <options> is <lsb32 baud><crc>
+                            Returns:
+                                <magic><msg_length><lsb32 error_code><crc>
+                            The response is sent at the old rate.  If
+                            error_code is 0 the server then switches to the
+                            new rate, and the client should do the same
+                            before sending any further command.
 */
 
 /* Specifics of the rpi_boot implementation:
@@ -144,6 +154,10 @@
     If v1, and the file /raspbootin is requested, we send cmd_id 3 and save
         the appropriate section to the buffer (and discard the rest)
     If v1, and any other file is requested, we return error code ENOENT
+
+    The 'baud' config command uses cmd_id 5 (if supported) to move both ends
+    to the new rate, then checks the link with cmd_id 0.  If that fails we
+    go back to the old rate.
 */
 
 #ifndef ENABLE_SERIAL
@@ -162,7 +176,7 @@
 #define READDIR_BUF_LEN         0x1000
 #define MAX_RETRIES             3
 
-#define CLIENT_CAPABILITIES     0x1f
+#define CLIENT_CAPABILITIES     0x3f
 
 #define BYTE(num, idx)      (((num) >> ((idx) * 8)) & 0xff)
 
@@ -234,7 +248,8 @@ static int send_message_int(int cmd_id, void *send_buf, size_t send_buf_len,
     // The crc of the request is calculated from 'options'
     uint32_t crc = crc32(send_buf, send_buf_len);
 
-    // Disable debug output on the uart
+    // Send any debug output still queued, then take over the uart
+    uart_flush();
     rpi_boot_output_state ostate = output_get_state();
     output_disable_uart();
 
@@ -254,6 +269,7 @@ static int send_message_int(int cmd_id, void *send_buf, size_t send_buf_len,
     uart_putc(BYTE(crc, 1));
     uart_putc(BYTE(crc, 2));
     uart_putc(BYTE(crc, 3));
+    uart_flush();
 
     // Wait for the response
     usleep(2000);
@@ -302,8 +318,8 @@ static int send_message_int(int cmd_id, void *send_buf, size_t send_buf_len,
     size_t data_to_pad = 0;
     if(data_to_read_to_buffer > recv_buf_len)
     {
-        data_to_read_to_buffer = recv_buf_len;
         data_to_discard = data_to_read_to_buffer - recv_buf_len;
+        data_to_read_to_buffer = recv_buf_len;
     }
     else if(recv_buf_len > data_to_read_to_buffer)
         data_to_pad = recv_buf_len - data_to_read_to_buffer;
@@ -312,22 +328,33 @@ static int send_message_int(int cmd_id, void *send_buf, size_t send_buf_len,
     crc = crc32_append(crc, &magic, 4);
     crc = crc32_append(crc, &resp_length, 4);
     crc = crc32_append(crc, &error_code, 4);
+    // The crc of the data is calculated once it is all received rather
+    //  than per byte
     int data_read = 0;
     uint8_t *rptr = (uint8_t *)recv_buf;
     while(data_to_read_to_buffer--)
     {
         r_buf = uart_getc_timeout(UART_TIMEOUT);
         CHECK(r_buf, 4);
-        crc = crc32_append(crc, &r_buf, 1);
         *rptr++ = r_buf;
         data_read++;
     }
+    crc = crc32_append(crc, recv_buf, (size_t)data_read);
+
+    uint8_t discard_buf[64];
+    size_t discard_len = 0;
     while(data_to_discard--)
     {
         r_buf = uart_getc_timeout(UART_TIMEOUT);
         CHECK(r_buf, 5);
-        crc = crc32_append(crc, &r_buf, 1);
+        discard_buf[discard_len++] = r_buf;
+        if(discard_len == sizeof(discard_buf))
+        {
+            crc = crc32_append(crc, discard_buf, discard_len);
+            discard_len = 0;
+        }
     }
+    crc = crc32_append(crc, discard_buf, discard_len);
     while(data_to_pad--)
         *rptr++ = 0;
     crc = crc32_finish(crc);
@@ -427,6 +454,36 @@ int raspbootin_init(struct fs **fs)
     return 0;
 }
 
+int raspbootin_set_baud(uint32_t baud)
+{
+    // Ask the server to change rate, then follow it
+    if(!(server_capabilities & (1 << 5)))
+        return UNSUPPORTED_CMD;
+
+    uint8_t req[4] = { BYTE(baud, 0), BYTE(baud, 1), BYTE(baud, 2),
+                       BYTE(baud, 3) };
+    int ret = send_message(5, req, sizeof(req), 0, 0);
+    if(ret < 0)
+    {
+        printf("RASPBOOTIN: server refused %u baud (%i)\n", baud, ret);
+        return ret;
+    }
+
+    uint32_t old_baud = uart_get_baud();
+    if(uart_set_baud(baud) != 0)
+        return UNKNOWN_ERROR;
+
+    // Check the server can still be heard
+    uint32_t caps;
+    if(send_message(0, 0, 0, &caps, sizeof(uint32_t)) != sizeof(uint32_t))
+    {
+        uart_set_baud(old_baud);
+        printf("RASPBOOTIN: no response from server at %u baud\n", baud);
+        return TIMEOUT;
+    }
+    return 0;
+}
+
 static struct dirent *raspbootin_read_directory(struct fs *fs, char **name)
 {
     (void)fs;
@@ -31,7 +31,14 @@
 #define TIMEOUT         -6
 #define INVALID_MAGIC   -7
 #define UNKNOWN_ERROR   -8
+#define INVALID_BAUD    -9
 
 #define MAGIC           0x27594131
 
+#ifdef BUILDING_RPIBOOT
+#include <stdint.h>
+
+int raspbootin_set_baud(uint32_t baud);
+#endif
+
 #endif
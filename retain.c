@@ -0,0 +1,142 @@
+/* Copyright (C) 2016 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* The manifest is a single persistent record, which persist.c protects with
+ * a CRC.  The manifest from the previous boot is read the first time it is
+ * needed and a new one, describing only the images loaded on this boot, is
+ * written as each image is loaded.
+ *
+ * An image is only reused if its file has the same key (see imagekey.c),
+ * and the copy in memory has the same CRC as when it was loaded.  Anything written to it by the
+ * previously booted kernel therefore causes a normal load.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "crc32.h"
+#include "imagekey.h"
+#include "memchunk.h"
+#include "persist.h"
+#include "retain.h"
+
+#ifdef DEBUG2
+#define RETAIN_DEBUG
+#endif
+
+#define RETAIN_PERSIST_TAG	PERSIST_TAG('I', 'M', 'G', 'S')
+#define RETAIN_MAX			16
+
+struct retain_entry
+{
+	struct image_key key;
+	uint32_t addr;
+	uint32_t length;
+	uint32_t crc;			// of the image in memory
+};
+
+struct retain_manifest
+{
+	uint32_t count;
+	struct retain_entry entries[RETAIN_MAX];
+};
+
+static struct retain_manifest *prev = NULL;
+static struct retain_manifest cur;
+static int prev_read = 0;
+
+static void read_prev(void)
+{
+	if(prev_read)
+		return;
+	prev_read = 1;
+
+	size_t length;
+	struct retain_manifest *m = (struct retain_manifest *)persist_get(
+			RETAIN_PERSIST_TAG, &length);
+	if(!m || (length != sizeof(struct retain_manifest)) ||
+			(m->count > RETAIN_MAX))
+		return;
+
+	// Take a copy, as the record is replaced as soon as anything is loaded
+	prev = (struct retain_manifest *)malloc(sizeof(struct retain_manifest));
+	if(prev)
+		memcpy(prev, m, sizeof(struct retain_manifest));
+}
+
+static void add_entry(const struct image_key *key, uint32_t addr, uint32_t length, uint32_t crc)
+{
+	if(cur.count >= RETAIN_MAX)
+		return;
+
+	struct retain_entry *e = &cur.entries[cur.count++];
+	e->key = *key;
+	e->addr = addr;
+	e->length = length;
+	e->crc = crc;
+
+	persist_set(RETAIN_PERSIST_TAG, &cur, sizeof(struct retain_manifest));
+}
+
+// If the previous boot left an image matching key in memory (at addr, if it
+//  is not 0) reserve it and return its address, otherwise return 0
+uint32_t retain_reuse(const struct image_key *key, uint32_t addr, uint32_t *length)
+{
+	read_prev();
+	if(!prev)
+		return 0;
+
+	for(uint32_t i = 0; i < prev->count; i++)
+	{
+		struct retain_entry *e = &prev->entries[i];
+		if(memcmp(&e->key, key, sizeof(struct image_key)))
+			continue;
+		if(addr && (e->addr != addr))
+			break;
+
+		if(crc32((const void *)(uintptr_t)e->addr, e->length) != e->crc)
+		{
+#ifdef RETAIN_DEBUG
+			printf("RETAIN: image at 0x%08x has changed\n", e->addr);
+#endif
+			break;
+		}
+
+		// It may overlap something already loaded on this boot
+		if(!chunk_get_chunk(e->addr, e->length))
+			break;
+
+		add_entry(key, e->addr, e->length, e->crc);
+		*length = e->length;
+		return e->addr;
+	}
+
+	return 0;
+}
+
+// Record an image loaded on this boot
+void retain_add(const struct image_key *key, uint32_t addr, uint32_t length)
+{
+	read_prev();
+	add_entry(key, addr, length, crc32((const void *)(uintptr_t)addr, length));
+}
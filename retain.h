@@ -0,0 +1,40 @@
+/* Copyright (C) 2016 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Reuse of images left in memory by a warm reboot
+ *
+ * A manifest of the images loaded on this boot is kept in the persistent
+ * area.  On the next boot, if an image's file is unchanged and its copy in
+ * memory still has the same CRC, it is reserved and used in place rather
+ * than being read from disk again.
+ */
+
+#ifndef RETAIN_H
+#define RETAIN_H
+
+#include <stdint.h>
+#include "imagekey.h"
+
+uint32_t retain_reuse(const struct image_key *key, uint32_t addr, uint32_t *length);
+void retain_add(const struct image_key *key, uint32_t addr, uint32_t length);
+
+#endif
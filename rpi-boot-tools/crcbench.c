@@ -0,0 +1,142 @@
+/* Copyright (C) 2016 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Host throughput benchmark for crc32.c
+ *
+ * Build with 'make crcbench' and run ./crcbench.  Checks crc32() against
+ * the standard check value and a byte-at-a-time reference, including
+ * when the data is fed in pieces, then compares their throughput.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "../crc32.h"
+
+extern const uint32_t crc32_tab[];
+
+#define BENCH_MAX	(1 << 20)
+
+// The previous one byte per iteration version
+static uint32_t ref_crc32(const void *buf, size_t size)
+{
+	const uint8_t *p = buf;
+	uint32_t crc = ~0U;
+	while(size--)
+		crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return crc ^ ~0U;
+}
+
+static int check(const uint8_t *buf)
+{
+	int errors = 0;
+
+	if(crc32("123456789", 9) != 0xCBF43926)
+	{
+		printf("check value failed: %08x\n", crc32("123456789", 9));
+		errors++;
+	}
+
+	for(size_t n = 0; n < 200; n++)
+	{
+		for(size_t off = 0; off < 8; off++)
+		{
+			uint32_t expected = ref_crc32(buf + off, n);
+			if(crc32(buf + off, n) != expected)
+			{
+				printf("n=%zu off=%zu failed\n", n, off);
+				errors++;
+			}
+
+			// The same data in two pieces
+			size_t split = n / 3;
+			uint32_t crc = crc32_start();
+			crc = crc32_append(crc, buf + off, split);
+			crc = crc32_append(crc, buf + off + split, n - split);
+			if(crc32_finish(crc) != expected)
+			{
+				printf("n=%zu off=%zu split=%zu failed\n", n, off, split);
+				errors++;
+			}
+		}
+	}
+	return errors;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Run for about 50ms and return MiB/s
+static double rate(int ref, const uint8_t *buf, size_t n)
+{
+	size_t iters = (16 << 20) / n + 1;
+	volatile uint32_t sink = 0;
+	double start, elapsed;
+
+	for(;;)
+	{
+		start = now();
+		for(size_t i = 0; i < iters; i++)
+			sink += ref ? ref_crc32(buf, n) : crc32(buf, n);
+		elapsed = now() - start;
+		if(elapsed > 0.05)
+			break;
+		iters *= 2;
+	}
+	(void)sink;
+	return (double)n * (double)iters / elapsed / (1024.0 * 1024.0);
+}
+
+int main(void)
+{
+	static const size_t sizes[] = { 4, 16, 64, 512, 4096, 65536, BENCH_MAX };
+	uint8_t *buf = malloc(BENCH_MAX + 8);
+	if(!buf)
+		return 1;
+	for(size_t i = 0; i < BENCH_MAX + 8; i++)
+		buf[i] = (uint8_t)(i * 131 + (i >> 8));
+
+	int errors = check(buf);
+	printf("correctness: %s\n", errors ? "FAILED" : "ok");
+
+	printf("%8s %4s %12s %12s %8s\n", "size", "off", "bytes MiB/s",
+			"crc32 MiB/s", "speedup");
+	for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		for(size_t off = 0; off < 2; off++)
+		{
+			double r0 = rate(1, buf + off, sizes[i]);
+			double r1 = rate(0, buf + off, sizes[i]);
+			printf("%8zu %4zu %12.0f %12.0f %7.2fx\n", sizes[i], off, r0, r1,
+					r1 / r0);
+		}
+	}
+
+	free(buf);
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+#!/usr/bin/env python
+
+# Decode an rpi-boot log into text.
+#
+# Invoke as ./decodeLog.py < input > output
+#
+# The input is either a log file written by the console_log command (a run
+# of records, ending at the first thing which is not one, such as the EOF
+# marker of a nofs partition), or a copy of the whole ring as passed to the
+# kernel (the rpi-boot-log module).  See struct boot_log in multiboot.h.
+
+import struct
+import sys
+
+BOOT_LOG_MAGIC = 0x474c4252
+BOOT_LOG_HEADER = struct.Struct('<8I')
+RECORD_HEADER = struct.Struct('<IHBB')
+
+BOOT_LOG_LEVEL_MASK = 0x07
+BOOT_LOG_PAD = 0x40
+BOOT_LOG_CONTINUED = 0x80
+
+LEVELS = { 3: 'E', 6: ' ' }
+
+def record_length(text_len):
+	return (RECORD_HEADER.size + text_len + 7) & ~7
+
+def records(data, start, end):
+	# Yield (timestamp, level, subsystem, message) from data[start:end]
+	while start + RECORD_HEADER.size <= end:
+		ts, text_len, level, subsys_len = RECORD_HEADER.unpack_from(data, start)
+		length = record_length(text_len)
+		if level != BOOT_LOG_PAD:
+			if ((level & ~(BOOT_LOG_LEVEL_MASK | BOOT_LOG_CONTINUED)) or
+					subsys_len > text_len or start + length > end):
+				return
+			text = data[start + RECORD_HEADER.size:start + RECORD_HEADER.size + text_len]
+			yield (ts, level, text[:subsys_len].decode('utf-8', 'replace'),
+					text[subsys_len:].decode('utf-8', 'replace'))
+		start += length
+
+def ring_records(data):
+	magic, version, size, head, tail, dropped, r0, r1 = BOOT_LOG_HEADER.unpack_from(data, 0)
+	ring = data[BOOT_LOG_HEADER.size:BOOT_LOG_HEADER.size + size]
+	if dropped:
+		sys.stderr.write('%i records were lost before reaching the log file\n' % dropped)
+
+	# Records never wrap, so read up to the end then from the start
+	used = (head - tail) % (1 << 32)
+	start = tail % size
+	if used > size:
+		return
+	if start + used > size:
+		for r in records(ring, start, size):
+			yield r
+		for r in records(ring, 0, start + used - size):
+			yield r
+	else:
+		for r in records(ring, start, start + used):
+			yield r
+
+def main():
+	data = sys.stdin.buffer.read()
+	if len(data) >= BOOT_LOG_HEADER.size and \
+			struct.unpack_from('<I', data, 0)[0] == BOOT_LOG_MAGIC:
+		recs = ring_records(data)
+	else:
+		recs = records(data, 0, len(data))
+
+	out = sys.stdout
+	last_ts = None
+	continuing = False
+	for ts, level, subsys, msg in recs:
+		if not continuing:
+			if last_ts is not None and ts < last_ts:
+				out.write('--- restarted ---\n')
+			last_ts = ts
+			prefix = '[%6i.%06i] %s ' % (ts // 1000000, ts % 1000000,
+					LEVELS.get(level & BOOT_LOG_LEVEL_MASK, '?'))
+			out.write(prefix + (subsys + ': ' if subsys else ''))
+		out.write(msg)
+		continuing = bool(level & BOOT_LOG_CONTINUED)
+		if not continuing:
+			out.write('\n')
+	if continuing:
+		out.write('\n')
+
+main()
@@ -0,0 +1,265 @@
+/* Copyright (C) 2016 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/* Host (or qemu-user) microbenchmark for the mem*() routines in mem.c
+ *
+ * Build with 'make membench' and run ./membench.  For an ARM figure build
+ * with an ARM HOSTCC and run under qemu-arm/qemu-aarch64, e.g.
+ *  make membench HOSTCC=arm-linux-gnueabihf-gcc
+ *
+ * Every routine is first checked against a byte-at-a-time reference for
+ * all small sizes and alignments, then both are timed over a range of
+ * sizes with aligned and misaligned buffers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+// mem.c is built with its functions renamed to these
+void *rb_memcpy(void *dest, const void *src, size_t n);
+void *rb_memset(void *s, int c, size_t n);
+void *rb_memmove(void *dest, const void *src, size_t n);
+int rb_memcmp(const void *s1, const void *s2, size_t n);
+
+/* The previous byte loop versions, for comparison.  volatile stops the
+ *  host compiler vectorising them, which the loader's own build (no FP or
+ *  SIMD registers) cannot do either */
+static void *ref_memcpy(void *dest, const void *src, size_t n)
+{
+	const volatile uint8_t *s = (const uint8_t *)src;
+	uint8_t *d = (uint8_t *)dest;
+	while(n--)
+		*d++ = *s++;
+	return dest;
+}
+
+static void *ref_memset(void *s, int c, size_t n)
+{
+	volatile uint8_t *d = (uint8_t *)s;
+	while(n--)
+		*d++ = (uint8_t)c;
+	return s;
+}
+
+static void *ref_memmove(void *dest, const void *src, size_t n)
+{
+	const volatile uint8_t *s = (const uint8_t *)src;
+	uint8_t *d = (uint8_t *)dest;
+	if(d <= s)
+	{
+		while(n--)
+			*d++ = *s++;
+	}
+	else
+	{
+		while(n--)
+			d[n] = s[n];
+	}
+	return dest;
+}
+
+static int ref_memcmp(const void *s1, const void *s2, size_t n)
+{
+	const volatile uint8_t *a = (const uint8_t *)s1;
+	const volatile uint8_t *b = (const uint8_t *)s2;
+	while(n--)
+	{
+		if(*a != *b)
+			return *a - *b;
+		a++;
+		b++;
+	}
+	return 0;
+}
+
+#define CHECK_MAX	300
+#define CHECK_ALIGN	16
+#define BUF_SIZE	(CHECK_MAX + 4 * CHECK_ALIGN)
+#define BENCH_MAX	(1 << 20)
+
+static uint8_t a[BUF_SIZE], b[BUF_SIZE], ra[BUF_SIZE], rb[BUF_SIZE];
+
+static void fill(uint8_t *buf, size_t n, unsigned int seed)
+{
+	for(size_t i = 0; i < n; i++)
+		buf[i] = (uint8_t)(i * 131 + seed * 7 + 1);
+}
+
+static int sign(int v)
+{
+	return (v > 0) - (v < 0);
+}
+
+static int check(void)
+{
+	int errors = 0;
+
+	for(size_t n = 0; n <= CHECK_MAX; n++)
+	{
+		for(size_t da = 0; da < CHECK_ALIGN; da++)
+		{
+			for(size_t sa = 0; sa < CHECK_ALIGN; sa++)
+			{
+				fill(a, BUF_SIZE, 0); fill(b, BUF_SIZE, 1);
+				fill(ra, BUF_SIZE, 0); fill(rb, BUF_SIZE, 1);
+				rb_memcpy(a + da, b + sa, n);
+				ref_memcpy(ra + da, rb + sa, n);
+				if(ref_memcmp(a, ra, BUF_SIZE))
+				{
+					printf("memcpy: n=%zu da=%zu sa=%zu failed\n", n, da, sa);
+					errors++;
+				}
+
+				// Overlapping in both directions within one buffer
+				fill(a, BUF_SIZE, 0); fill(ra, BUF_SIZE, 0);
+				rb_memmove(a + da, a + sa + CHECK_ALIGN, n);
+				ref_memmove(ra + da, ra + sa + CHECK_ALIGN, n);
+				rb_memmove(a + sa + CHECK_ALIGN, a + da, n);
+				ref_memmove(ra + sa + CHECK_ALIGN, ra + da, n);
+				if(ref_memcmp(a, ra, BUF_SIZE))
+				{
+					printf("memmove: n=%zu da=%zu sa=%zu failed\n", n, da, sa);
+					errors++;
+				}
+
+				// Differences at the first, a middle and the last byte
+				fill(a, BUF_SIZE, 0);
+				fill(b, BUF_SIZE, 0);
+				rb_memmove(b + sa, a + da, n);
+				if(rb_memcmp(a + da, b + sa, n) != 0)
+				{
+					printf("memcmp: n=%zu da=%zu sa=%zu equal failed\n", n, da, sa);
+					errors++;
+				}
+				for(size_t pos = 0; n && pos < n; pos += (n + 1) / 2)
+				{
+					b[sa + pos] ^= 0x80;
+					if(sign(rb_memcmp(a + da, b + sa, n)) !=
+							sign(ref_memcmp(a + da, b + sa, n)))
+					{
+						printf("memcmp: n=%zu da=%zu sa=%zu pos=%zu failed\n",
+								n, da, sa, pos);
+						errors++;
+					}
+					b[sa + pos] ^= 0x80;
+				}
+			}
+
+			fill(a, BUF_SIZE, 0); fill(ra, BUF_SIZE, 0);
+			rb_memset(a + da, (int)(n & 0xff), n);
+			ref_memset(ra + da, (int)(n & 0xff), n);
+			if(ref_memcmp(a, ra, BUF_SIZE))
+			{
+				printf("memset: n=%zu da=%zu failed\n", n, da);
+				errors++;
+			}
+		}
+	}
+	return errors;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Run op over n bytes repeatedly for about 50ms and return MiB/s
+static double rate(int op, int ref, uint8_t *d, uint8_t *s, size_t n)
+{
+	size_t iters = (64 << 20) / n + 1;
+	double start, elapsed;
+
+	for(;;)
+	{
+		start = now();
+		for(size_t i = 0; i < iters; i++)
+		{
+			switch(op)
+			{
+				case 0:
+					(ref ? ref_memcpy : rb_memcpy)(d, s, n);
+					break;
+				case 1:
+					(ref ? ref_memset : rb_memset)(d, (int)i, n);
+					break;
+				case 2:
+					(ref ? ref_memmove : rb_memmove)(d, s, n);
+					break;
+				case 3:
+					if((ref ? ref_memcmp : rb_memcmp)(d, s, n) == 1234)
+						puts("");
+					break;
+			}
+		}
+		elapsed = now() - start;
+		if(elapsed > 0.05)
+			break;
+		iters *= 2;
+	}
+	return (double)n * (double)iters / elapsed / (1024.0 * 1024.0);
+}
+
+int main(void)
+{
+	static const char *names[] = { "memcpy", "memset", "memmove", "memcmp" };
+	static const size_t sizes[] = { 8, 32, 256, 4096, 65536, BENCH_MAX };
+	static const size_t aligns[][2] = { { 0, 0 }, { 0, 1 }, { 3, 0 }, { 1, 3 } };
+	int errors = check();
+
+	printf("correctness: %s\n", errors ? "FAILED" : "ok");
+
+	uint8_t *d = malloc(BENCH_MAX + 64);
+	uint8_t *s = malloc(BENCH_MAX + 64);
+	if(!d || !s)
+		return 1;
+	fill(d, BENCH_MAX + 64, 0);
+	fill(s, BENCH_MAX + 64, 0);
+
+	printf("%-8s %8s %6s %12s %12s %8s\n", "op", "size", "d/s",
+			"bytes MiB/s", "words MiB/s", "speedup");
+	for(int op = 0; op < 4; op++)
+	{
+		for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		{
+			for(size_t j = 0; j < sizeof(aligns) / sizeof(aligns[0]); j++)
+			{
+				uint8_t *dp = d + aligns[j][0];
+				uint8_t *sp = s + aligns[j][1];
+				if(op == 3)
+					ref_memcpy(dp, sp, sizes[i]);
+				double r0 = rate(op, 1, dp, sp, sizes[i]);
+				double r1 = rate(op, 0, dp, sp, sizes[i]);
+				printf("%-8s %8zu %3zu/%zu %12.0f %12.0f %7.2fx\n",
+						names[op], sizes[i], aligns[j][0], aligns[j][1],
+						r0, r1, r1 / r0);
+			}
+		}
+	}
+
+	free(d);
+	free(s);
+	return errors ? 1 : 0;
+}
@@ -37,6 +37,11 @@ void mbox_set_base(uint32_t base);
 void timer_set_base(uint32_t base);
 
 void uart_init();
+void uart_set_clock(uint32_t hz);
+int uart_set_baud(uint32_t baud);
+
+// Baud rate requested by the current-speed property of the uart node
+static uint32_t uart_dtb_baud = 0;
 
 static void parse_reg(const char *dtb, int node, int parent,
 		void (*cb)(uint32_t addr, uint32_t length))
@@ -334,6 +339,14 @@ static void uart_cb(const char *dtb, int node, int parent)
 	printf("\n");
 #endif
 	parse_reg(dtb, node, parent, uart_reg_cb);
+
+	int plen;
+	const void *clock = fdt_getprop(dtb, node, "clock-frequency", &plen);
+	if(clock && (plen == 4))
+		uart_set_clock(read_wordbe(clock, 0));
+	const void *speed = fdt_getprop(dtb, node, "current-speed", &plen);
+	if(speed && (plen == 4))
+		uart_dtb_baud = read_wordbe(speed, 0);
 }
 
 static void gpio_cb(const char *dtb, int node, int parent)
@@ -378,9 +391,12 @@ void parse_dtb_devices(const char *dtb)
 	parse_dtb_compatible(dtb, "pl011", uart_cb);
 	parse_dtb_compatible(dtb, "bcm2835-gpio", gpio_cb);
 	parse_dtb_compatible(dtb, "bcm2835-system-timer", timer_cb);
+	// the mailbox is needed to find the uart clock
+	parse_dtb_compatible(dtb, "bcm2835-mbox", mbox_cb);
 	uart_init();
+	if(uart_dtb_baud)
+		uart_set_baud(uart_dtb_baud);
 	parse_dtb_compatible(dtb, "bcm2835-mmc", mmc_cb);
-	parse_dtb_compatible(dtb, "bcm2835-mbox", mbox_cb);
 }
 
 void dump_tree(const char *dtb, int node, int parent, int indent)
@@ -30,6 +30,8 @@ const char uppercase[] = "0123456789abcdef";
 int (*stderr_putc)(int c);
 int (*stdout_putc)(int c);
 int (*stream_putc)(int c, FILE *stream);
+int (*stderr_write)(const char *buf, size_t len);
+int (*stdout_write)(const char *buf, size_t len);
 
 int fputc(int c, FILE *stream)
 {
@@ -51,10 +53,32 @@ int putchar(int c)
 	return fputc(c, stdout);
 }
 
+// Write a buffer to stdout/stderr in one go where the output supports it
+size_t stdio_write(const void *buf, size_t len, FILE *stream)
+{
+	int (*write_func)(const char *, size_t) = NULL;
+	if(stream == stdout)
+		write_func = stdout_write;
+	else if(stream == stderr)
+		write_func = stderr_write;
+
+	if(write_func)
+		write_func((const char *)buf, len);
+	else
+	{
+		const char *s = (const char *)buf;
+		for(size_t i = 0; i < len; i++)
+			fputc(s[i], stream);
+	}
+	return len;
+}
+
 int fputs(const char *s, FILE *stream)
 {
-	while(*s)
-		fputc(*s++, stream);
+	size_t len = 0;
+	while(s[len])
+		len++;
+	stdio_write(s, len, stream);
 	return 0;
 }
 
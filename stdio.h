@@ -37,6 +37,7 @@ int fputs(const char *, FILE *stream);
 int putc(int c, FILE *stream);
 int putchar(int c);
 int puts(const char *s);
+size_t stdio_write(const void *buf, size_t len, FILE *stream);
 
 int printf(const char *format, ...);
 int fprintf(FILE *stream, const char *format, ...);
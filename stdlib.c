@@ -26,33 +26,11 @@
 
 int errno;
 
-void *memcpy(void *dest, const void *src, size_t n)
-{
-	char *s = (char *)src;
-	char *d = (char *)dest;
-	while(n > 0)
-	{
-		*d++ = *s++;
-		n--;
-	}
-	return dest;
-}
-
-void *memset(void *s, int c, size_t n)
-{
-	char *dest = (char *)s;
-	while(n > 0)
-	{
-		*dest++ = (char)c;
-		n--;
-	}
-	return s;
-}
-
 void abort(void)
 {
 	fputs("abort() called\n", stdout);
 	fputs("abort() called\n", stderr);
+	fflush(stdout);
 
 	while(1);
 }
@@ -152,38 +130,6 @@ char *strupr(char *s)
 	return ret;
 }
 
-void *memmove(void *dest, const void *src, size_t n)
-{
-	char *d = (char *)dest;
-	const char *s = (const char *)src;
-
-	if(d > s)
-		return memcpy(dest, src, n);
-	else
-	{
-		d += n;
-		s += n;
-
-		while(n--)
-			*--d = *--s;
-		return dest;
-	}
-}
-
-int memcmp(const void *s1, const void *s2, size_t n)
-{
-	const char *s1c = (const char *)s1;
-	const char *s2c = (const char *)s2;
-
-	while(n--)
-	{
-		int v = *s1c++ - *s2c++;
-		if(v != 0)
-			return v;
-	}
-	return 0;
-}
-
 size_t strnlen(const char *s, size_t maxlen)
 {
 	size_t cnt = 0;
@@ -0,0 +1,152 @@
+/* Copyright (C) 2016 by John Cronin <jncronin@tysos.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "block.h"
+#include "memchunk.h"
+#include "timer.h"
+#include "timeline.h"
+
+#define TIMELINE_MAX			64
+
+static struct boot_timeline_entry entries[TIMELINE_MAX];
+static int count = 0;
+static int last_phase = -1;
+static struct boot_timeline *handed_over = NULL;
+
+static struct boot_timeline_entry *new_entry(const char *name, uint32_t type, uint32_t us)
+{
+	if(count >= TIMELINE_MAX)
+		return NULL;
+
+	struct boot_timeline_entry *e = &entries[count++];
+	memset(e, 0, sizeof(struct boot_timeline_entry));
+	e->start_us = us;
+	e->type = type;
+	strncpy(e->name, name, sizeof(e->name) - 1);
+	return e;
+}
+
+static void end_phase(uint32_t us)
+{
+	if(last_phase >= 0)
+		entries[last_phase].duration_us = us - entries[last_phase].start_us;
+	last_phase = -1;
+}
+
+// Start a new phase, ending the previous one
+void timeline_mark_at(const char *name, uint32_t us)
+{
+	end_phase(us);
+
+	if(new_entry(name, BOOT_TIMELINE_PHASE, us))
+		last_phase = count - 1;
+	else
+		last_phase = -1;
+}
+
+void timeline_mark(const char *name)
+{
+	timeline_mark_at(name, timer_get_us());
+}
+
+// The file load in progress (there is only ever one)
+static uint32_t file_start_us;
+static uint32_t file_start_io;
+
+void timeline_file_start(void)
+{
+	file_start_us = timer_get_us();
+	file_start_io = block_get_io_count();
+}
+
+// Record the load started by timeline_file_start()
+void timeline_file_end(const char *name, uint32_t bytes)
+{
+	uint32_t us = timer_get_us();
+	struct boot_timeline_entry *e = new_entry(name, BOOT_TIMELINE_FILE,
+			file_start_us);
+	if(e)
+	{
+		e->duration_us = us - file_start_us;
+		e->bytes = bytes;
+		e->io_count = block_get_io_count() - file_start_io;
+	}
+}
+
+static void timeline_print(const struct boot_timeline *t)
+{
+	uint32_t base = t->entries[0].start_us;
+
+	printf("TIMELINE: %i us from %s to handover\n",
+			timer_get_us() - base, t->entries[0].name);
+	for(uint32_t i = 0; i < t->count; i++)
+	{
+		const struct boot_timeline_entry *e = &t->entries[i];
+		if(e->type == BOOT_TIMELINE_FILE)
+			printf("TIMELINE: %8i    file %s: %i bytes, %i requests, %i us\n",
+					e->start_us - base, e->name, e->bytes, e->io_count,
+					e->duration_us);
+		else
+			printf("TIMELINE: %8i  %s: %i us\n", e->start_us - base,
+					e->name, e->duration_us);
+	}
+}
+
+// End the last phase and copy the timeline to memory reserved for the kernel
+const struct boot_timeline *timeline_finish(void)
+{
+	end_phase(timer_get_us());
+	if(count == 0)
+		return NULL;
+
+	size_t size = sizeof(struct boot_timeline) +
+		count * sizeof(struct boot_timeline_entry);
+	struct boot_timeline *t = (struct boot_timeline *)(uintptr_t)
+		chunk_get_any_chunk((uint32_t)size);
+	if(!t)
+	{
+		printf("TIMELINE: unable to allocate %i bytes\n", size);
+		return NULL;
+	}
+
+	t->magic = BOOT_TIMELINE_MAGIC;
+	t->version = BOOT_TIMELINE_VERSION;
+	t->entry_size = sizeof(struct boot_timeline_entry);
+	t->count = (uint32_t)count;
+	memset(t->reserved, 0, sizeof(t->reserved));
+	memcpy(t->entries, entries, count * sizeof(struct boot_timeline_entry));
+
+	// Printing is slow on the UART, so the handover time includes it
+	timeline_print(t);
+	t->handover_us = timer_get_us();
+
+	handed_over = t;
+	return t;
+}
+
+const struct boot_timeline *get_boot_timeline(void)
+{
+	return handed_over;
+}
@@ -31,11 +31,26 @@
 
 static uint32_t timer_base = TIMER_BASE;
 
+/* Called whenever a timer is checked, i.e. from every busy-wait loop, to do
+ *  background work such as draining the uart transmit buffer */
+static void (*idle_hook)(void) = NULL;
+
+void timer_set_idle_hook(void (*hook)(void))
+{
+	idle_hook = hook;
+}
+
 void timer_set_base(uint32_t base)
 {
 	timer_base = base;
 }
 
+// The free running counter of the system timer (microseconds since reset)
+uint32_t timer_get_us(void)
+{
+	return mmio_read(timer_base + TIMER_CLO);
+}
+
 int usleep(useconds_t usec)
 {
 	struct timer_wait tw = register_timer(usec);
@@ -70,6 +85,9 @@ struct timer_wait register_timer(useconds_t usec)
 
 int compare_timer(struct timer_wait tw)
 {
+	if(idle_hook)
+		idle_hook();
+
 	uint32_t cur_timer = mmio_read(timer_base + TIMER_CLO);
 
 	if(tw.trigger_value == 0)
@@ -36,6 +36,8 @@ struct timer_wait
 int usleep(useconds_t usec);
 struct timer_wait register_timer(useconds_t usec);
 int compare_timer(struct timer_wait tw);
+uint32_t timer_get_us(void);
+void timer_set_idle_hook(void (*hook)(void));
 
 #define TIMEOUT_WAIT(stop_if_true, usec) 		\
 do {							\
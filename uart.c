@@ -24,6 +24,7 @@
 #include "mmio.h"
 #include "uart.h"
 #include "timer.h"
+#include "mbox.h"
 
 #define GPIO_BASE 			0x20200000
 #define GPPUD 				0x94
@@ -48,9 +49,29 @@
 #define UART0_ITOP			0x88
 #define UART0_TDR			0x8C
 
+// Mailbox clock id of the UART reference clock
+#define UART_CLOCK_ID			2
+
+// Reference clock assumed if neither the firmware nor the DTB give one
+#define UART_DEFAULT_CLOCK		3000000
+
 static uint32_t uart_base = UART0_BASE;
 static uint32_t gpio_base = GPIO_BASE;
 
+/* Transmit ring buffer.  Interrupts are left disabled for the kernel's
+ *  sake, so the ring is drained into the FIFO whenever more is written and
+ *  from the timer idle hook, which runs in every busy-wait loop (e.g. while
+ *  waiting for the SD card).  Must be a power of two. */
+#define UART_TX_RING_SIZE		4096
+
+static uint8_t tx_ring[UART_TX_RING_SIZE];
+static uint32_t tx_head = 0;		// next byte to add
+static uint32_t tx_tail = 0;		// next byte to send
+static int tx_buffered = 1;
+
+static uint32_t uart_clock = 0;
+static uint32_t uart_baud = 0;
+
 void uart_set_base(uint32_t base)
 {
 	uart_base = base;
@@ -61,6 +82,105 @@ void gpio_set_base(uint32_t base)
 	gpio_base = base;
 }
 
+// Override the reference clock rate, e.g. from the clock-frequency property of the DTB
+void uart_set_clock(uint32_t hz)
+{
+	uart_clock = hz;
+}
+
+uint32_t uart_get_clock()
+{
+	if(uart_clock)
+		return uart_clock;
+
+	uintptr_t mb_addr = 0x00007000;		// 0x7000 in L2 cache coherent mode
+	volatile uint32_t *mailbuffer = (uint32_t *)mb_addr;
+
+	mailbuffer[0] = 8 * 4;		// size of this message
+	mailbuffer[1] = 0;			// this is a request
+
+	mailbuffer[2] = 0x00030002;	// get clock rate tag
+	mailbuffer[3] = 0x8;		// value buffer size
+	mailbuffer[4] = 0x4;		// is a request, value length = 4
+	mailbuffer[5] = UART_CLOCK_ID;	// clock id + space to return clock id
+	mailbuffer[6] = 0;			// space to return rate (in Hz)
+
+	mailbuffer[7] = 0;			// closing tag
+
+	mbox_write(MBOX_PROP, mb_addr);
+	mbox_read(MBOX_PROP);
+
+	if((mailbuffer[1] == MBOX_SUCCESS) && (mailbuffer[5] == UART_CLOCK_ID) &&
+			mailbuffer[6])
+		uart_clock = mailbuffer[6];
+	else
+		uart_clock = UART_DEFAULT_CLOCK;
+
+	return uart_clock;
+}
+
+/* Program the baud rate divisor.  The PL011 divides the reference clock by
+ *  16 * (IBRD + FBRD / 64), so 64ths of the divisor are clock * 4 / baud,
+ *  rounded to the nearest.  Anything still queued is sent at the old rate
+ *  first. */
+int uart_set_baud(uint32_t baud)
+{
+	if(baud == 0)
+		return -1;
+
+	uint32_t clock = uart_get_clock();
+	uint32_t div = (clock / baud) * 4 + ((clock % baud) * 4 + baud / 2) / baud;
+	uint32_t ibrd = div >> 6;
+	uint32_t fbrd = div & 0x3f;
+
+	if((ibrd == 0) || (ibrd > 0xffff))
+	{
+		printf("UART: cannot set %u baud from a %u Hz clock\n", baud, clock);
+		return -1;
+	}
+
+	uart_flush();
+
+	// The divisor may only be changed while the uart is disabled
+	uint32_t cr = mmio_read(uart_base + UART0_CR);
+	mmio_write(uart_base + UART0_CR, 0x0);
+
+	// Drop FEN to empty the FIFOs
+	mmio_write(uart_base + UART0_LCRH, 0x0);
+
+	mmio_write(uart_base + UART0_IBRD, ibrd);
+	mmio_write(uart_base + UART0_FBRD, fbrd);
+
+	// The divisor is latched by the write to LCRH: 8 bit, no parity,
+	//  1 stop bit, FIFOs enabled
+	mmio_write(uart_base + UART0_LCRH, (1 << 4) | (1 << 5) | (1 << 6));
+
+	/* FIFO levels: RX at 1/2 full, TX at 1/8.  Transmission is polled
+	 *  so these only matter once a kernel enables uart interrupts, where
+	 *  they give it time to respond before the receive FIFO overflows at
+	 *  high rates */
+	mmio_write(uart_base + UART0_IFLS, (2 << 3) | (0 << 0));
+
+	mmio_write(uart_base + UART0_CR, cr);
+
+	uart_baud = baud;
+	return 0;
+}
+
+uint32_t uart_get_baud()
+{
+	if(uart_baud)
+		return uart_baud;
+
+	// Still as set up by the firmware: work it out from the divisor
+	uint32_t div = (mmio_read(uart_base + UART0_IBRD) << 6) |
+		(mmio_read(uart_base + UART0_FBRD) & 0x3f);
+	if(div == 0)
+		return 0;
+	uint32_t clock = uart_get_clock();
+	return (clock / div) * 4 + ((clock % div) * 4 + div / 2) / div;
+}
+
 void uart_init()
 {
 	// disable UART
@@ -78,12 +198,10 @@ void uart_init()
 	// clear interrupts
 	mmio_write(uart_base + UART0_ICR, 0x7ff);
 
-	// set baud rate - commented out therefore use default
-	//mmio_write(uart_base + UART0_IBRD, 1);
-	//mmio_write(uart_base + UART0_FBRD, 40);
+	// the baud rate is left as set by the firmware until uart_set_baud()
 
-	// 8 bit, no parity, 1 stop bit - commented out therefore use default
-	//mmio_write(uart_base + UART0_LCRH, (1 << 4) | (1 << 5) | (1 << 6));
+	// 8 bit, no parity, 1 stop bit, FIFOs enabled
+	mmio_write(uart_base + UART0_LCRH, (1 << 4) | (1 << 5) | (1 << 6));
 
 	// interrupt mask
 	mmio_write(uart_base + UART0_IMSC, (1 << 1) | (1 << 4) | (1 << 5) | (1 << 6) | (1 << 7) |
@@ -91,25 +209,95 @@ void uart_init()
 
 	// enable device, transmit and receive
 	mmio_write(uart_base + UART0_CR, (1 << 0) | (1 << 8) | (1 << 9));
+
+	timer_set_idle_hook(uart_poll);
 }
 
-int uart_putc(int byte)
+// Move as much of the transmit ring as will fit into the FIFO
+void uart_poll()
+{
+	while((tx_tail != tx_head) && !(mmio_read(uart_base + UART0_FR) & (1 << 5)))
+	{
+		mmio_write(uart_base + UART0_DR, tx_ring[tx_tail & (UART_TX_RING_SIZE - 1)]);
+		tx_tail++;
+	}
+}
+
+// Wait until everything written has been sent
+void uart_flush()
+{
+	while(tx_tail != tx_head)
+		uart_poll();
+
+	// Wait for the FIFO and shift register to empty
+	while(mmio_read(uart_base + UART0_FR) & (1 << 3));
+}
+
+/* Switch between buffered and direct transmission.  Direct is used once
+ *  the kernel is running, as nothing may call the idle hook then. */
+void uart_set_buffered(int buffered)
 {
-	while(mmio_read(uart_base + UART0_FR) & (1 << 5))
-        usleep(2000);
+	if(!buffered)
+		uart_flush();
+	tx_buffered = buffered;
+}
+
+static inline void uart_tx(uint8_t byte)
+{
+	// Straight to the FIFO if nothing is queued ahead of it and it has room
+	if((tx_head == tx_tail) && !(mmio_read(uart_base + UART0_FR) & (1 << 5)))
+	{
+		mmio_write(uart_base + UART0_DR, byte);
+		return;
+	}
+
+	if(!tx_buffered)
+	{
+		/* Spin rather than sleep while the FIFO is full: it drains a byte
+		 *  every ~87us at 115200 baud, far less than the granularity of
+		 *  usleep() */
+		while(mmio_read(uart_base + UART0_FR) & (1 << 5));
+		mmio_write(uart_base + UART0_DR, byte);
+		return;
+	}
+
+	// If the ring is full wait for room
+	while(tx_head - tx_tail == UART_TX_RING_SIZE)
+		uart_poll();
 
-	mmio_write(uart_base + UART0_DR, (uint8_t)(byte & 0xff));
+	tx_ring[tx_head & (UART_TX_RING_SIZE - 1)] = byte;
+	tx_head++;
+}
+
+int uart_putc(int byte)
+{
+	uart_tx((uint8_t)(byte & 0xff));
 
 	if(byte == '\n')
-		uart_putc('\r');
+		uart_tx('\r');
 
+	uart_poll();
 	return byte;
 }
 
+int uart_write(const char *buf, size_t len)
+{
+	for(size_t i = 0; i < len; i++)
+	{
+		uart_tx((uint8_t)buf[i]);
+		if(buf[i] == '\n')
+			uart_tx('\r');
+	}
+	uart_poll();
+	return (int)len;
+}
+
 int uart_getc()
 {
+    // Poll rather than sleep: at high rates the receive FIFO fills in well
+    //  under a millisecond
     while(mmio_read(uart_base + UART0_FR) & (1 << 4))
-        usleep(2000);
+        uart_poll();
     return mmio_read(uart_base + UART0_DR) & 0xff;
 }
 
@@ -23,10 +23,19 @@
 #define UART_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include "timer.h"
 
 void uart_init();
+void uart_set_clock(uint32_t hz);
+uint32_t uart_get_clock();
+int uart_set_baud(uint32_t baud);
+uint32_t uart_get_baud();
 int uart_putc(int byte);
+int uart_write(const char *buf, size_t len);
+void uart_poll();
+void uart_flush();
+void uart_set_buffered(int buffered);
 void uart_puts(const char *str);
 int uart_getc();
 int uart_getc_timeout(useconds_t timeout);
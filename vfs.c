@@ -63,6 +63,15 @@ static struct vfs_entry *find_ve(const char *path)
 	return (void *)0;
 }
 
+// Return the block device holding the filesystem registered as dev_name
+struct block_device *vfs_get_block_device(const char *dev_name)
+{
+	struct vfs_entry *dev = find_ve(dev_name);
+	if(dev)
+		return dev->fs->parent;
+	return (void *)0;
+}
+
 int vfs_set_default(char *dev_name)
 {
 	struct vfs_entry *dev = find_ve(dev_name);
@@ -286,11 +295,7 @@ size_t fwrite(void *ptr, size_t size, size_t nmemb, FILE *stream)
 
 	size_t bytes_to_write = size * nmemb;
 	if((stream == stdout) || (stream == stderr))
-	{
-		uint8_t *c_buf = (uint8_t *)ptr;
-		for(size_t i = 0; i < bytes_to_write; i++)
-			split_putc((char)c_buf[i]);
-	}
+		stdio_write(ptr, bytes_to_write, stream);
 	else
 	{
 		size_t nmemb_to_write = bytes_to_write / size;
@@ -312,6 +317,11 @@ int fflush(FILE *fp)
 		errno = EINVAL;
 		return -1;
 	}
+	if((fp == stdout) || (fp == stderr))
+	{
+		output_flush();
+		return 0;
+	}
 	if(fp->fflush_cb)
 		fp->fflush_cb(fp);
 	if(fp->fs->fflush)
@@ -63,6 +63,7 @@ struct vfs_file
     long len;
 	int flags;
 	int (*fflush_cb)(FILE *f);
+	uint32_t mtime;		// as struct dirent, 0 if not known
 };
 
 int fseek(FILE *stream, long offset, int whence);
@@ -76,6 +77,7 @@ void rewind(FILE *stream);
 int vfs_register(struct fs *fs);
 void vfs_list_devices();
 char **vfs_get_device_list();
+struct block_device *vfs_get_block_device(const char *dev_name);
 int vfs_set_default(char *dev_name);
 char *vfs_get_default();
 